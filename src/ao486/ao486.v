@@ -174,9 +174,9 @@ wire        exc_restore_esp;
 wire        exc_set_rflag;
 wire        exc_debug_start;
 wire        exc_init;
-wire        exc_load;
+wire        exc_load /* verilator public */;
 wire [31:0] exc_eip;
-wire [7:0]  exc_vector;
+wire [7:0]  exc_vector /* verilator public */;
 wire [15:0] exc_error_code;
 wire        exc_push_error;
 wire        exc_soft_int;
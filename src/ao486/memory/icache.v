@@ -70,6 +70,8 @@ module icache(
     input               snoop_we
 );
 
+/* verilator public_module */
+
 //------------------------------------------------------------------------------
 
 localparam STATE_IDLE = 1'd0;
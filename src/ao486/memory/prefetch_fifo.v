@@ -50,7 +50,7 @@ module prefetch_fifo(
     //RESP:
     input           prefetchfifo_accept_do,      // fetch wants to pop the head entry this cycle
     output [67:0]   prefetchfifo_accept_data,    // data to fetch
-    output          prefetchfifo_accept_empty    // if the FIFO is empty
+    output          prefetchfifo_accept_empty /* verilator public */    // if the FIFO is empty
     //END
 );
 
@@ -154,7 +154,7 @@ module tlb(
 
 //------------------------------------------------------------------------------
 
-reg [4:0]   state;
+reg [4:0]   state /* verilator public */;
 
 reg [31:0]  linear;
 reg         su;
@@ -238,7 +238,7 @@ wire translate_combined_su;
 
 
 wire        translate_do;
-wire        translate_valid;
+wire        translate_valid /* verilator public */;
 wire [31:0] translate_physical;
 wire        translate_pwt;
 wire        translate_pcd;
@@ -337,7 +337,7 @@ reg [31:0]  exe_extra;
 reg [31:0]  src;
 reg [31:0]  dst;
 reg [31:0]  exe_address_effective;
-reg         exe_prefix_2byte;
+reg         exe_prefix_2byte /* verilator public */;
 
 always @(posedge clk) begin if(rst_n[0] == 1'b0) exe_decoder              <= 40'd0;     else if(e_load) exe_decoder              <= rd_decoder[39:0];        end
 always @(posedge clk) begin if(rst_n[0] == 1'b0) exe_eip                  <= 32'd0;     else if(e_load) exe_eip                  <= rd_eip;                  end
@@ -59,7 +59,7 @@ module pipeline(
     input               exc_pf_check,
     
     //pipeline eip
-    output      [31:0]  eip,
+    output      [31:0]  eip /* verilator public */,
     output      [31:0]  dec_eip,
     output      [31:0]  rd_eip,
     output      [31:0]  exe_eip,
@@ -159,20 +159,20 @@ module pipeline(
     // prefetch
     output      [1:0]   prefetch_cpl,
     output      [31:0]  prefetch_eip,
-    output      [63:0]  cs_cache,
+    output      [63:0]  cs_cache /* verilator public */,
     
     // debug outputs for LED indicators
     output      [15:0]  cs_debug,
     
-    output              cr0_pg,
+    output              cr0_pg /* verilator public */,
     output              cr0_wp,
     output              cr0_am,
     output              cr0_cd,
     output              cr0_nw,
     
-    output              acflag,
+    output              acflag /* verilator public */,
     
-    output      [31:0]  cr3,
+    output      [31:0]  cr3 /* verilator public */,
     
     // prefetch_fifo
     output              prefetchfifo_accept_do,
@@ -276,7 +276,7 @@ module pipeline(
 
 //------------------------------------------------------------------------------
 
-wire [1:0]  cpl;
+wire [1:0]  cpl /* verilator public */;
 
 assign prefetch_cpl = cpl;
 
@@ -379,41 +379,41 @@ wire [31:0] idtr_base;
 wire [15:0] idtr_limit;
 
 wire        es_cache_valid;
-wire [63:0] es_cache;
+wire [63:0] es_cache /* verilator public */;
 wire        cs_cache_valid;
 wire        ss_cache_valid;
-wire [63:0] ss_cache;
+wire [63:0] ss_cache /* verilator public */;
 wire        ds_cache_valid;
-wire [63:0] ds_cache;
+wire [63:0] ds_cache /* verilator public */;
 wire        fs_cache_valid;
-wire [63:0] fs_cache;
+wire [63:0] fs_cache /* verilator public */;
 wire        gs_cache_valid;
-wire [63:0] gs_cache;
+wire [63:0] gs_cache /* verilator public */;
 wire        tr_cache_valid;
 wire [63:0] tr_cache;
 wire        ldtr_cache_valid;
 wire [63:0] ldtr_cache;
 
-wire        idflag;
-wire        vmflag;
-wire        rflag;
-wire        ntflag;
-wire [1:0]  iopl;
-wire        oflag;
-wire        dflag;
-wire        iflag;
-wire        tflag;
-wire        sflag;
-wire        zflag;
-wire        aflag;
-wire        pflag;
-wire        cflag;
+wire        idflag /* verilator public */;
+wire        vmflag /* verilator public */;
+wire        rflag /* verilator public */;
+wire        ntflag /* verilator public */;
+wire [1:0]  iopl /* verilator public */;
+wire        oflag /* verilator public */;
+wire        dflag /* verilator public */;
+wire        iflag /* verilator public */;
+wire        tflag /* verilator public */;
+wire        sflag /* verilator public */;
+wire        zflag /* verilator public */;
+wire        aflag /* verilator public */;
+wire        pflag /* verilator public */;
+wire        cflag /* verilator public */;
 
 wire        cr0_ne;
 wire        cr0_ts;
 wire        cr0_em;
 wire        cr0_mp;
-wire        cr0_pe;
+wire        cr0_pe /* verilator public */;
 
 wire [31:0] cr2;
 
@@ -486,7 +486,7 @@ fetch fetch_inst(
 
 //------------------------------------------------------------------------------
 
-wire        v8086_mode;
+wire        v8086_mode /* verilator public */;
 wire        protected_mode;
 
 wire        micro_busy;
@@ -314,14 +314,14 @@ wire [31:0] ss_limit;
 wire [31:0] ldtr_base;
 
 
-reg [15:0]  wr_decoder;
-reg         wr_operand_32bit;
-reg         wr_address_32bit;
-reg [1:0]   wr_prefix_group_1_rep;
-reg         wr_prefix_group_1_lock;
+reg [15:0]  wr_decoder /* verilator public */;
+reg         wr_operand_32bit /* verilator public */;
+reg         wr_address_32bit /* verilator public */;
+reg [1:0]   wr_prefix_group_1_rep /* verilator public */;
+reg         wr_prefix_group_1_lock /* verilator public */;
 reg         wr_is_8bit;
-reg [6:0]   wr_cmd;
-reg [3:0]   wr_cmdex;
+reg [6:0]   wr_cmd /* verilator public */;
+reg [3:0]   wr_cmdex /* verilator public */;
 reg         wr_dst_is_reg;
 reg         wr_dst_is_rm;
 reg         wr_dst_is_memory;
@@ -345,10 +345,10 @@ reg         wr_arith_sub_carry;
 reg         wr_arith_sbb_carry;
 reg         wr_mult_overflow;
 
-wire wr_finished;
+wire wr_finished /* verilator public */;
 
 wire wr_not_finished;
-wire wr_hlt_in_progress;
+wire wr_hlt_in_progress /* verilator public */;
 wire wr_inhibit_interrupts_and_debug;
 wire wr_inhibit_interrupts;
 wire iflag_to_reg;
@@ -358,7 +358,7 @@ wire wr_interrupt_possible_prepare;
 
 wire wr_clear_rflag;
 
-wire wr_string_in_progress;
+wire wr_string_in_progress /* verilator public */;
 reg  wr_string_in_progress_last;
 
 reg wr_first_cycle;
@@ -535,8 +535,8 @@ assign ldtr_base   = { ldtr_cache[63:56], ldtr_cache[39:16] };
 
 //------------------------------------------------------------------------------
 
-wire wr_ready;
-wire w_load;
+wire wr_ready /* verilator public */;
+wire w_load /* verilator public */;
 
 wire wr_waiting;
 
@@ -74,7 +74,7 @@ reg               [3:0] memory_be;
 reg   [LINESIZE_BITS-1:0] fillcount;
 reg [CACHEBURST_BITS-1:0] burstleft;
 
-reg   [2:0] state;
+reg   [2:0] state /* verilator public */;
 reg         CPU_REQ_hold;
 
 // fifo for snoop
@@ -34,29 +34,28 @@ module driver_sd (
     inout       [3:0]   sd_dat
 );
 
-reg [2:0] state;
+reg [2:0] state /* verilator public */;
 localparam INIT = 0;
 localparam IDLE = 1;
 localparam READ = 2;
 localparam WRITE = 3;
+localparam BUSY = 4;        // command accepted, card latency before the data
 
 reg [31:0] base_address;
 reg [23:0] sd_sector;
 reg [7:0] sd_sector_count;
 
-localparam SD_BUF_SIZE = 128*1024*1024;
-logic [7:0] sd_buf[0:SD_BUF_SIZE-1] /* verilator public */;
-int unsigned sd_size;
+// The card contents live on the C++ side (sd_disk.h), which maps the image
+// file and only pages in the sectors that are used. Byte addresses, one dword
+// per call.
+import "DPI-C" context function int unsigned sd_read(input longint unsigned addr);
+import "DPI-C" context function void sd_write(input longint unsigned addr, input int unsigned data);
+// Start of a transfer, returns the cycles the card takes before the data (0: none)
+import "DPI-C" context function int unsigned sd_command(input int unsigned write, input int unsigned sector, input int unsigned count);
 
-export "DPI-C" task sd_write;
-task sd_write(
-    input  int unsigned        addr,
-    input  byte unsigned       data
-);
-    // if (addr < 16) $display("DPI sd_write(%m): addr=%x, data=%02x", addr, data);
-    if (addr >= SD_BUF_SIZE) $display("sd_write overflow: %x >= %x", addr, SD_BUF_SIZE);
-    sd_buf[addr] = data;
-endtask
+reg [31:0] latency;
+reg [31:0] busy_cycles;
+reg busy_write;
 
 // initial $readmemh("dos6.vhd.hex", sd_buf);
 
@@ -69,9 +68,9 @@ always @(posedge clk) begin
             avs_readdata <= 0;         // initializing
             if (state == IDLE) begin
                 avs_readdata <= 2;     // idle
-            end else if (state == READ) begin
+            end else if (state == READ || state == BUSY && !busy_write) begin
                 avs_readdata <= 3;     // reading
-            end else if (state == WRITE) begin
+            end else if (state == WRITE || state == BUSY && busy_write) begin
                 avs_readdata <= 4;     // writing
             end
         end else if (avs_read && avs_address == 2'd2) begin
@@ -81,7 +80,7 @@ always @(posedge clk) begin
     end
 end
 
-reg [29:0] sd_buf_ptr, sd_buf_ptr_end;
+reg [32:0] sd_buf_ptr, sd_buf_ptr_end;
 
 always @(posedge clk) begin
     if (!rst_n) begin
@@ -103,29 +102,39 @@ always @(posedge clk) begin
                     end else if (avs_address == 2'd3) begin
                         sd_buf_ptr <= sd_sector * 512;       // start address
                         sd_buf_ptr_end <= (sd_sector + sd_sector_count) * 512; // end address
-                        if (avs_writedata == 32'd2) begin
-                            state <= READ;
-                            avm_address <= base_address;
+                        if (avs_writedata == 32'd2 || avs_writedata == 32'd3) begin
+                            latency = sd_command(avs_writedata == 32'd3, sd_sector, sd_sector_count);
+                            busy_cycles <= latency - 1;
+                            busy_write <= avs_writedata == 32'd3;
+                            if (latency != 0)
+                                state <= BUSY;
+                            else if (avs_writedata == 32'd3) begin
+                                state <= WRITE;
+                                avm_read <= 1;
+                            end else
+                                state <= READ;
+                            if (avs_writedata == 32'd2) avm_address <= base_address;
                             // $display("READ: sd_sector=%x, sd_sector_count=%x", sd_sector, sd_sector_count);
-                        end else if (avs_writedata == 32'd3) begin
-                            state <= WRITE;
-                            avm_read <= 1;
                         end
                     end
                 end
             end
+            BUSY: begin
+                if (busy_cycles != 0) begin
+                    busy_cycles <= busy_cycles - 1;
+                end else if (busy_write) begin
+                    state <= WRITE;
+                    avm_read <= 1;
+                end else begin
+                    state <= READ;
+                end
+            end
             READ: begin
                 avm_write <= 1;
-                avm_writedata <= {sd_buf[sd_buf_ptr+3], sd_buf[sd_buf_ptr+2], sd_buf[sd_buf_ptr+1], sd_buf[sd_buf_ptr]};
-                // Debug: show first few reads to verify SD card data
-                // if (sd_buf_ptr < 32) begin
-                //     $display("SD READ (%m): ptr=%x, data=%02x%02x%02x%02x", sd_buf_ptr,
-                //              sd_buf[sd_buf_ptr+3], sd_buf[sd_buf_ptr+2], 
-                //              sd_buf[sd_buf_ptr+1], sd_buf[sd_buf_ptr]);
-                // end
+                if (!avm_write) avm_writedata <= sd_read(sd_buf_ptr);   // first dword, then one ahead on each handshake
                 if (avm_write && !avm_waitrequest) begin     // handshake
                     sd_buf_ptr <= sd_buf_ptr + 4;
-                    avm_writedata <= {sd_buf[sd_buf_ptr+7], sd_buf[sd_buf_ptr+6], sd_buf[sd_buf_ptr+5], sd_buf[sd_buf_ptr+4]};
+                    avm_writedata <= sd_read(sd_buf_ptr + 4);
                     avm_address <= avm_address + 4;
                     if (sd_buf_ptr + 4 == sd_buf_ptr_end) begin
                         avm_write <= 0;
@@ -134,11 +143,7 @@ always @(posedge clk) begin
                 end
             end
             WRITE: if (avm_readdatavalid) begin  // drive hdd-to-sd streaming with avm_read
-                $display("WRITE: sd[%x]=%x", sd_buf_ptr, avm_readdata);
-                sd_buf[sd_buf_ptr] <= avm_readdata[7:0];
-                sd_buf[sd_buf_ptr+1] <= avm_readdata[15:8];
-                sd_buf[sd_buf_ptr+2] <= avm_readdata[23:16];
-                sd_buf[sd_buf_ptr+3] <= avm_readdata[31:24];
+                sd_write(sd_buf_ptr, avm_readdata);
                 sd_buf_ptr <= sd_buf_ptr + 4;
                 if (sd_buf_ptr + 4 == sd_buf_ptr_end)
                     state <= IDLE;
@@ -45,11 +45,11 @@ module pit(
 
 //------------------------------------------------------------------------------ system clock
 
-reg [27:0] clk_rate;
+reg [27:0] clk_rate /* verilator public */;
 always @(posedge clk) clk_rate <= clock_rate;
 
 reg ce_system_counter;
-reg [27:0] sum = 0;
+reg [27:0] sum /* verilator public_flat_rw */ = 0;
 always @(posedge clk) begin
 
 	ce_system_counter = 0;
@@ -60,7 +60,7 @@ always @(posedge clk) begin
 	end
 end
 
-reg system_clock;
+reg system_clock /* verilator public_flat_rw */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)           system_clock <= 1'b0;
     else if(ce_system_counter)  system_clock <= ~system_clock;
@@ -77,14 +77,14 @@ always @(posedge clk) if(io_read) io_readdata <=
 
 //------------------------------------------------------------------------------ refresh counter
 
-reg [5:0] counter_1_cnt;
+reg [5:0] counter_1_cnt /* verilator public_flat_rw */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)                                       counter_1_cnt <= 6'd0;
     else if(ce_system_counter && counter_1_cnt == 6'd35)    counter_1_cnt <= 6'd0;
     else if(ce_system_counter)                              counter_1_cnt <= counter_1_cnt + 6'd1;
 end
 
-reg counter_1_toggle;
+reg counter_1_toggle /* verilator public_flat_rw */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)                                       counter_1_toggle <= 1'b0;
     else if(ce_system_counter && counter_1_cnt == 6'd35)    counter_1_toggle <= ~(counter_1_toggle);
@@ -92,7 +92,7 @@ end
 
 //------------------------------------------------------------------------------ speaker
 
-reg speaker_gate;
+reg speaker_gate /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)                  speaker_gate <= 1'b0;
     else if(io_write && io_address[2]) speaker_gate <= io_writedata[0];
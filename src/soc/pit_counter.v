@@ -30,7 +30,7 @@ module pit_counter(
     
     input             clock,
     input             gate,
-    output reg        out,
+    output reg        out /* verilator public_flat_rw */,
     
     input       [7:0] data_in,
     input             set_control_mode,
@@ -44,19 +44,19 @@ module pit_counter(
 
 //------------------------------------------------------------------------------
 
-reg [2:0] mode;
+reg [2:0] mode /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)         mode <= 3'd2;
     else if(set_control_mode) mode <= data_in[3:1];
 end
 
-reg bcd;
+reg bcd /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)         bcd <= 1'd0;
     else if(set_control_mode) bcd <= data_in[0];
 end
 
-reg [1:0] rw_mode;
+reg [1:0] rw_mode /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)         rw_mode <= 2'd1;
     else if(set_control_mode) rw_mode <= data_in[5:4];
@@ -64,7 +64,7 @@ end
 
 //------------------------------------------------------------------------------
 
-reg [7:0] counter_l;
+reg [7:0] counter_l /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)                               counter_l <= 8'd0;
     else if(set_control_mode)                       counter_l <= 8'd0;
@@ -72,7 +72,7 @@ always @(posedge clk) begin
     else if(write && rw_mode == 2'd1)               counter_l <= data_in;
 end
 
-reg [7:0] counter_m;
+reg [7:0] counter_m /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)                               counter_m <= 8'd0;
     else if(set_control_mode)                       counter_m <= 8'd0;
@@ -80,21 +80,21 @@ always @(posedge clk) begin
     else if(write && rw_mode == 2'd2)               counter_m <= data_in;
 end
 
-reg [7:0] output_l;
+reg [7:0] output_l /* verilator public_flat_rw */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)                       output_l <= 8'd0;
     else if(latch_count && ~output_latched) output_l <= counter[7:0];
     else if(~output_latched)                output_l <= counter[7:0];
 end
 
-reg [7:0] output_m;
+reg [7:0] output_m /* verilator public_flat_rw */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)                       output_m <= 8'd0;
     else if(latch_count && ~output_latched) output_m <= counter[15:8];
     else if(~output_latched)                output_m <= counter[15:8];
 end
 
-reg output_latched;
+reg output_latched /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)                               output_latched <= 1'b0;
     else if(set_control_mode)                       output_latched <= 1'b0;
@@ -102,7 +102,7 @@ always @(posedge clk) begin
     else if(read && (rw_mode != 2'd3 || msb_read))  output_latched <= 1'b0;
 end
 
-reg null_counter;
+reg null_counter /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)                                null_counter <= 1'b0;
     else if(set_control_mode)                        null_counter <= 1'b1;
@@ -130,7 +130,7 @@ always @(posedge clk) begin
     else if(latch_status && ~status_latched) status <= { out, null_counter, rw_mode, mode, bcd };
 end
 
-reg status_latched;
+reg status_latched /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)           status_latched <= 1'b0;
     else if(set_control_mode)   status_latched <= 1'b0;
@@ -147,7 +147,7 @@ assign data_out =
 
 //------------------------------------------------------------------------------
 
-reg two_byte_write;
+reg two_byte_write /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)                 two_byte_write <= 1'b0;
     else if(write && rw_mode == 2'd3) two_byte_write <= 1'b1;
@@ -172,22 +172,22 @@ always @(posedge clk) read_last <= read;
 reg read_pulse;
 always @(posedge clk) read_pulse <= read_last & ~read;
 
-reg clock_last;
+reg clock_last /* verilator public_flat_rw */;
 always @(posedge clk) clock_last <= clock;
 
-reg clock_pulse;
+reg clock_pulse /* verilator public */;
 always @(posedge clk) clock_pulse <= clock_last & ~clock;
 
 reg gate_last;
 always @(posedge clk) gate_last <= gate;
 
-reg gate_sampled;
+reg gate_sampled /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)             gate_sampled <= 1'b0;
     else if(~clock_last && clock) gate_sampled <= gate;
 end
 
-reg trigger;
+reg trigger /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)             trigger <= 1'b0;
     else if(~gate_last && gate)   trigger <= 1'b1;
@@ -234,7 +234,7 @@ end
 
 //------------------------------------------------------------------------------
 
-reg written;
+reg written /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)                                    written <= 1'b0;
     else if(set_control_mode)                            written <= 1'b0;
@@ -243,14 +243,14 @@ always @(posedge clk) begin
     else if(load)                                        written <= 1'b0;
 end
 
-reg control_set;
+reg control_set /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)         control_set <= 1'b0;
     else if(set_control_mode) control_set <= 1'b1;
     else if(load)             control_set <= 1'b0;
 end
 
-reg loaded;
+reg loaded /* verilator public */;
 always @(posedge clk) begin
     if(rst_n == 1'b0)         loaded <= 1'b0;
     else if(set_control_mode) loaded <= 1'b0;
@@ -285,7 +285,7 @@ wire [15:0] counter_minus_1 =
     (bcd && !counter[3:0])  ? { counter[15:4]  - 1'd1,    4'h9 } :
                                 counter - 1'd1;
 
-reg [15:0] counter;
+reg [15:0] counter /* verilator public_flat_rw */;   // advanced by the harness in an idle skip
 always @(posedge clk) begin
     if(rst_n == 1'b0) counter <= 16'd0;
     else if(load)     counter <= {counter_m, counter_l[7:1], counter_l[0] & (mode[1:0] != 2'd3)};
@@ -391,19 +391,19 @@ always @(posedge clk) begin
     else if(io_write && io_address == 1'b1 && ram_address == 7'h0B)     crb_freeze <= io_writedata[7];
 end
 
-reg crb_int_periodic_ena;
+reg crb_int_periodic_ena /* verilator public */;
 always @(posedge clk) begin
     if(mgmt_write && mgmt_address == 8'h0B)                             crb_int_periodic_ena <= mgmt_writedata[6];
     else if(io_write && io_address == 1'b1 && ram_address == 7'h0B)     crb_int_periodic_ena <= io_writedata[6];
 end
 
-reg crb_int_alarm_ena;
+reg crb_int_alarm_ena /* verilator public */;
 always @(posedge clk) begin
     if(mgmt_write && mgmt_address == 8'h0B)                             crb_int_alarm_ena <= mgmt_writedata[5];
     else if(io_write && io_address == 1'b1 && ram_address == 7'h0B)     crb_int_alarm_ena <= io_writedata[5];
 end
 
-reg crb_int_update_ena;
+reg crb_int_update_ena /* verilator public */;
 always @(posedge clk) begin
     if(mgmt_write && mgmt_address == 8'h0B)                             crb_int_update_ena <= ~(mgmt_writedata[7]) & mgmt_writedata[4];
     else if(io_write && io_address == 1'b1 && ram_address == 7'h0B)     crb_int_update_ena <= ~(io_writedata[7]) & io_writedata[4];
@@ -602,7 +602,7 @@ always @(posedge clk) begin
 	else if(dma_finished)                       dma_left <= 17'd0;
 end
 
-reg dma_in_progress;
+reg dma_in_progress /* verilator public */;
 always @(posedge clk) begin
 	if(rst_n == 1'b0)                           dma_in_progress <= 1'b0;
 	else if(sw_reset)                           dma_in_progress <= 1'b0;
@@ -118,7 +118,7 @@ reg general_enable_ram;
 reg general_io_space = 1'b1;
 
 //not implemented external regs:
-reg [1:0] general_clock_select;
+reg [1:0] general_clock_select /* verilator public */;
 reg       general_not_impl_odd_even_page;
 
 //------------------------------------------------------------------------------ general data write
@@ -155,9 +155,9 @@ wire seq_io_write = io_c_write && io_address == 4'h5;
 reg seq_async_reset_n;
 reg seq_sync_reset_n;
 
-reg seq_8dot_char;
+reg seq_8dot_char /* verilator public */;
 
-reg seq_dotclock_divided;
+reg seq_dotclock_divided /* verilator public */;
 
 reg seq_screen_disable; // Disables video output (blanks the screen) and turns off display data fetches, while CRTC synchronization pules are maintained.
 
@@ -231,25 +231,25 @@ wire crtc_io_write_compare = ((io_b_write && io_address == 4'd5) || (io_d_write
 
 //------------------------------------------------------------------------------ crtc data
 
-reg [8:0]   crtc_horizontal_total;
-reg [7:0]   crtc_horizontal_display_size;
+reg [8:0]   crtc_horizontal_total /* verilator public */;
+reg [7:0]   crtc_horizontal_display_size /* verilator public */;
 reg [8:0]   crtc_horizontal_blanking_start;
 reg [5:0]   crtc_horizontal_blanking_end;
 reg [8:0]   crtc_horizontal_retrace_start;
 reg [1:0]   crtc_horizontal_retrace_skew;
 reg [4:0]   crtc_horizontal_retrace_end;
 
-reg [10:0]  crtc_vertical_total;
-reg [10:0]  crtc_vertical_retrace_start;
-reg [3:0]   crtc_vertical_retrace_end;
-reg [10:0]  crtc_vertical_display_size;
-reg [10:0]  crtc_vertical_blanking_start;
-reg [7:0]   crtc_vertical_blanking_end;
+reg [10:0]  crtc_vertical_total /* verilator public */;
+reg [10:0]  crtc_vertical_retrace_start /* verilator public */;
+reg [3:0]   crtc_vertical_retrace_end /* verilator public */;
+reg [10:0]  crtc_vertical_display_size /* verilator public */;
+reg [10:0]  crtc_vertical_blanking_start /* verilator public */;
+reg [7:0]   crtc_vertical_blanking_end /* verilator public */;
 
 reg         crtc_vertical_doublescan;
 
 reg [4:0]   crtc_row_preset;
-reg [4:0]   crtc_row_max;
+reg [4:0]   crtc_row_max /* verilator public */;
 reg [4:0]   crtc_row_underline;
 
 reg         crtc_cursor_off;
@@ -257,15 +257,15 @@ reg [4:0]   crtc_cursor_row_start;
 reg [4:0]   crtc_cursor_row_end;
 reg [1:0]   crtc_cursor_skew;
 
-reg [19:0]  crtc_address_start;
+reg [19:0]  crtc_address_start /* verilator public */;
 reg [1:0]   crtc_address_byte_panning;
-reg [8:0]   crtc_address_offset;
+reg [8:0]   crtc_address_offset /* verilator public */;
 reg [19:0]  crtc_address_cursor;
-reg         crtc_address_doubleword;
-reg         crtc_address_byte;
-reg         crtc_address_bit0;
-reg         crtc_address_bit13;
-reg         crtc_address_bit14;
+reg         crtc_address_doubleword /* verilator public */;
+reg         crtc_address_byte /* verilator public */;
+reg         crtc_address_bit0 /* verilator public */;
+reg         crtc_address_bit13 /* verilator public */;
+reg         crtc_address_bit14 /* verilator public */;
 
 reg         crtc_timing_enable = 1; // 0 = Forces horizontal and vertical sync signals to be inactive. No other registers or outputs are affected.
 
@@ -371,7 +371,7 @@ always @(posedge clk_sys) if(crtc_io_write && crtc_io_index == 5'h17) crtc_addre
 
 //------------------------------------------------------------------------------ crtc data write (extended)
 
-reg [7:0] crtc_reg31, crtc_reg32, crtc_reg33, crtc_reg34, crtc_reg35, crtc_reg36, crtc_reg37, crtc_reg3f;
+reg [7:0] crtc_reg31 /* verilator public */, crtc_reg32, crtc_reg33, crtc_reg34 /* verilator public */, crtc_reg35, crtc_reg36, crtc_reg37, crtc_reg3f;
 
 always @(posedge clk_sys) if(~rst_n) crtc_reg31 <= 0; else if(crtc_io_write && crtc_io_index == 'h31) crtc_reg31 <= io_writedata;
 always @(posedge clk_sys) if(~rst_n) crtc_reg32 <= 0; else if(crtc_io_write && crtc_io_index == 'h32) crtc_reg32 <= io_writedata;
@@ -683,7 +683,7 @@ reg       attrib_9bit_same_as_8bit;
 // 1 = txt monochrome attribute (e.g. MDA/Hercules Emulation)
 reg       attrib_mono_emulation;
 
-reg       attrib_graphic_mode;
+reg       attrib_graphic_mode /* verilator public */;
 
 reg [7:0] attrib_color_overscan;
 
@@ -1149,6 +1149,15 @@ dpram_difclk #(16,8) plane_ram_3
 	.q_b            (plane_ram3_q_new)
 );
 
+`ifdef VERILATOR
+// Character and attribute at a plane address, for the harness text console
+// (--console). Reads the RAM array directly, so it works with clk_vga gated.
+export "DPI-C" function vga_text_read;
+function int vga_text_read(input int addr);
+    vga_text_read = { 16'd0, plane_ram_1.mem[addr[15:0]], plane_ram_0.mem[addr[15:0]] };
+endfunction
+`endif
+
 //------------------------------------------------------------------------------
 
 reg [7:0] plane_ram0;
@@ -1372,7 +1381,7 @@ end
 //------------------------------------------------------------------------------
 
 reg vgareg_blank;
-reg vgaprep_not_displaying;
+reg vgaprep_not_displaying /* verilator public_flat_rw */;   // driven by the harness when clk_vga is gated
 
 wire [5:0] pel_palette;
 wire [5:0] host_palette_q;
@@ -1571,7 +1580,7 @@ always @(posedge clk_vga) if (ce_video) begin
   end
 end
 
-reg vgaprep_vert_blank;
+reg vgaprep_vert_blank /* verilator public_flat_rw */;
 always @(posedge clk_vga) if (ce_video) begin
   if (vgaprep_dot_timing) if (horiz_cnt == crtc_horizontal_retrace_start + { 9'h0, crtc_horizontal_retrace_skew }) begin
     if      (vert_cnt      == crtc_vertical_blanking_start)                       vgaprep_vert_blank <= 1'b1;
@@ -1590,7 +1599,7 @@ always @(posedge clk_vga) if (ce_video) begin
   end
 end
 
-reg vgaprep_vert_sync;
+reg vgaprep_vert_sync /* verilator public_flat_rw */;
 always @(posedge clk_vga) if (ce_video) begin
   if (vgaprep_dot_timing) if (horiz_cnt == crtc_horizontal_retrace_start + { 9'h0, crtc_horizontal_retrace_skew }) begin
     if      (vert_cnt      == crtc_vertical_retrace_start)                       vgaprep_vert_sync <= 1'b1;
@@ -1611,7 +1620,7 @@ end
 assign host_io_vertical_retrace = vgaprep_vert_sync;
 assign host_io_not_displaying   = vgaprep_not_displaying;
 
-reg vgaprep_vert_blank_last;
+reg vgaprep_vert_blank_last /* verilator public_flat_rw */;
 always @(posedge clk_vga) if (ce_video) vgaprep_vert_blank_last <= vgaprep_vert_blank;
 reg host_io_vertical_retrace_last;
 always @(posedge clk_vga) if (ce_video) host_io_vertical_retrace_last <= host_io_vertical_retrace;
@@ -131,11 +131,11 @@ wire [15:0] dma_writedata;
 wire        dma_16bit;
 
 // Boot loader signals
-reg [3:0]   boot_state;
+reg [3:0]   boot_state /* verilator public_flat_rw */;
 reg [31:0]  boot_addr;
 reg [15:0]  boot_sectors;        // Number of sectors remaining
 reg [7:0]   boot_words_in_sector; // Number of words remaining in current sector
-reg         boot_done;
+reg         boot_done /* verilator public */;
 reg  [1:0]  boot_phase;          // 0 = BIOS, 1 = VGA BIOS, 2 = CONFIG
 reg         cpu_reset_n;
 
@@ -168,11 +168,11 @@ localparam BOOT_LOAD_DATA   = 7;
 localparam BOOT_COMPLETE    = 8;
 
 // Management interface driven by SD sector 192
-reg  [15:0] mgmt_address;
+reg  [15:0] mgmt_address /* verilator public_flat_rw */;
 reg         mgmt_read;
 wire [31:0] mgmt_readdata;
-reg         mgmt_write;
-reg  [31:0] mgmt_writedata;
+reg         mgmt_write /* verilator public_flat_rw */;
+reg  [31:0] mgmt_writedata /* verilator public_flat_rw */;
 
 // Config sector parsing (phase 2)
 // New format: 4-byte address (use [15:0]) + 4-byte data, repeated; terminated by address==0
@@ -189,7 +189,7 @@ wire        mgmt_fdd_cs;
 wire        mgmt_rtc_cs;
 
 wire        interrupt_done;
-wire        interrupt_do;
+wire        interrupt_do /* verilator public */;
 wire  [7:0] interrupt_vector;
 reg  [15:0] interrupt;
 wire        irq_0, irq_1, irq_2, irq_3, irq_4, 
@@ -259,11 +259,11 @@ wire [29:0] avm_address /* verilator public */;      // dword address
 wire [31:0] avm_writedata /* verilator public */;
 wire [31:0] avm_readdata /* verilator public */;
 wire  [3:0] avm_byteenable /* verilator public */;
-wire  [3:0] avm_burstcount;
+wire  [3:0] avm_burstcount /* verilator public */;
 wire        avm_write /* verilator public */;
-wire        avm_read;
-wire        avm_waitrequest;
-wire        avm_readdatavalid;
+wire        avm_read /* verilator public */;
+wire        avm_waitrequest /* verilator public */;
+wire        avm_readdatavalid /* verilator public */;
 
 // main_memory to ddr/sdram
 wire [31:0] mem_address;
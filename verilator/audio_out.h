@@ -0,0 +1,61 @@
+#pragma once
+#include <SDL.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include "ring.h"
+
+// Live audio for --audio. The simulation pushes stereo frames into a lock-free
+// ring and the SDL audio callback pulls them. A full ring drops samples and an
+// empty one repeats the last frame, so neither side ever waits. The simulation
+// is usually slower than real time, so expect gaps.
+class AudioOut {
+public:
+    bool open(int rate) {
+        if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+            printf("SDL audio init failed: %s\n", SDL_GetError());
+            return false;
+        }
+        SDL_AudioSpec want = {}, have;
+        want.freq = rate;
+        want.format = AUDIO_S16SYS;
+        want.channels = 2;
+        want.samples = 1024;
+        want.callback = callback;
+        want.userdata = this;
+        dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+        if (!dev) {
+            printf("Cannot open audio device: %s\n", SDL_GetError());
+            return false;
+        }
+        SDL_PauseAudioDevice(dev, 0);
+        printf("Audio output at %d Hz\n", have.freq);
+        return true;
+    }
+
+    bool is_open() const { return dev != 0; }
+
+    void push(int16_t left, int16_t right) {
+        ring.push((uint32_t)(uint16_t)left | (uint32_t)(uint16_t)right << 16);
+    }
+
+    void close() {
+        if (!dev) return;
+        SDL_CloseAudioDevice(dev);
+        dev = 0;
+    }
+
+private:
+    static void callback(void *userdata, uint8_t *stream, int len) {
+        AudioOut *a = (AudioOut *)userdata;
+        uint32_t *out = (uint32_t *)stream;
+        for (int i = 0; i < len / 4; i++) {
+            a->ring.pop(a->last);
+            out[i] = a->last;
+        }
+    }
+
+    SDL_AudioDeviceID dev = 0;
+    uint32_t last = 0;                  // audio thread only
+    SpscRing<uint32_t, 16384> ring;     // ~0.3s at 48kHz
+};
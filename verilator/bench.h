@@ -0,0 +1,110 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <sys/resource.h>
+
+// Benchmark recorder for --bench: splits a run into phases and writes wall
+// time, simulated clk_sys cycles/s, share of time spent in eval() and peak
+// RSS of each phase as JSON. The RSS is the process peak so far at the end of
+// the phase (getrusage), not just that phase's.
+class Bench {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    struct Phase {
+        std::string name;
+        uint64_t sim_start, sim_end;
+        double wall;                // seconds
+        double eval;                // seconds spent in eval()
+        long peak_rss_kb;           // process peak at the end of the phase
+    };
+
+    uint64_t eval_ns = 0;           // accumulated by the caller around eval()
+
+    void begin(const char *name, uint64_t sim_time) {
+        if (active) end(sim_time);
+        cur.name = name;
+        cur.sim_start = sim_time;
+        eval_ns = 0;
+        t0 = clock::now();
+        active = true;
+    }
+
+    void end(uint64_t sim_time) {
+        if (!active) return;
+        cur.sim_end = sim_time;
+        cur.wall = std::chrono::duration<double>(clock::now() - t0).count();
+        cur.eval = eval_ns / 1e9;
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+        cur.peak_rss_kb = ru.ru_maxrss / 1024;  // bytes there
+#else
+        cur.peak_rss_kb = ru.ru_maxrss;
+#endif
+        phases.push_back(cur);
+        active = false;
+    }
+
+    const char *phase() const { return active ? cur.name.c_str() : ""; }
+
+    bool write_json(const char *fname, const std::string &image, uint64_t stop_time, int threads) {
+        FILE *f = fopen(fname, "w");
+        if (!f) {
+            printf("Error: Could not open %s for writing\n", fname);
+            return false;
+        }
+        Phase total = {"total", phases.empty() ? 0 : phases.front().sim_start,
+                       phases.empty() ? 0 : phases.back().sim_end, 0, 0, 0};
+        for (auto &p : phases) {
+            total.wall += p.wall;
+            total.eval += p.eval;
+            total.peak_rss_kb = std::max(total.peak_rss_kb, p.peak_rss_kb);
+        }
+        fprintf(f, "{\n  \"image\": \"%s\",\n  \"stop_time\": %llu,\n  \"threads\": %d,\n  \"phases\": [\n",
+                json_escape(image).c_str(), (unsigned long long)stop_time, threads);
+        for (size_t i = 0; i < phases.size(); i++) {
+            writePhase(f, phases[i]);
+            fprintf(f, "%s\n", i + 1 < phases.size() ? "," : "");
+        }
+        fprintf(f, "  ],\n  \"total\": ");
+        writePhase(f, total, false);
+        fprintf(f, "\n}\n");
+        fclose(f);
+        printf("Benchmark results written to %s\n", fname);
+        return true;
+    }
+
+private:
+    std::vector<Phase> phases;
+    Phase cur;
+    clock::time_point t0;
+    bool active = false;
+
+    static std::string json_escape(const std::string &s) {
+        std::string r;
+        for (unsigned char c : s) {
+            if (c == '"' || c == '\\') r += '\\';
+            if (c < 0x20) {
+                char u[8];
+                snprintf(u, sizeof(u), "\\u%04x", c);
+                r += u;
+            } else
+                r += (char)c;
+        }
+        return r;
+    }
+
+    static void writePhase(FILE *f, const Phase &p, bool indent = true) {
+        uint64_t cycles = (p.sim_end - p.sim_start) / 4;    // 4 steps per clk_sys cycle
+        fprintf(f, "%s{\"name\": \"%s\", \"sim_start\": %llu, \"sim_end\": %llu, \"cycles\": %llu, "
+                   "\"wall_s\": %.3f, \"cycles_per_s\": %.0f, \"eval_share\": %.3f, \"process_peak_rss_kb\": %ld}",
+                indent ? "    " : "", p.name.c_str(), (unsigned long long)p.sim_start,
+                (unsigned long long)p.sim_end, (unsigned long long)cycles, p.wall,
+                p.wall > 0 ? cycles / p.wall : 0.0, p.wall > 0 ? p.eval / p.wall : 0.0, p.peak_rss_kb);
+    }
+};
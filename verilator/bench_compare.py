@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+"""
+Compare two benchmark reports written by Vsystem --bench
+
+Used by `make bench` to show how much faster the fast build (no tracing,
+-O3) is than the debug build on the same workload. Phases are matched by
+name, with simulated clk_sys cycles/s of both runs and the speedup.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(fname):
+    try:
+        with open(fname) as f:
+            r = json.load(f)
+        return r, [r["total"]] + r["phases"]
+    except (OSError, ValueError, KeyError) as e:
+        print("%s: not a --bench report (%s)" % (fname, e), file=sys.stderr)
+        sys.exit(1)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("base", help="report of the reference run, e.g. the debug build")
+    ap.add_argument("other", help="report of the run to compare, e.g. the fast build")
+    args = ap.parse_args()
+
+    a, a_phases = load(args.base)
+    b, b_phases = load(args.other)
+    if a["stop_time"] != b["stop_time"]:
+        print("warning: stop times differ (%d, %d)" % (a["stop_time"], b["stop_time"]), file=sys.stderr)
+    b_by_name = {p["name"]: p for p in b_phases}
+
+    print("%s vs %s (%s)" % (args.base, args.other, a["image"]))
+    print("%-8s %14s %14s %8s" % ("phase", "base cyc/s", "other cyc/s", "speedup"))
+    for p in a_phases:
+        q = b_by_name.get(p["name"])
+        if q is None:
+            continue
+        speedup = q["cycles_per_s"] / p["cycles_per_s"] if p["cycles_per_s"] else 0
+        print("%-8s %14.0f %14.0f %7.2fx" % (p["name"], p["cycles_per_s"], q["cycles_per_s"], speedup))
+
+
+if __name__ == "__main__":
+    main()
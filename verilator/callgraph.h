@@ -0,0 +1,160 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// Call-graph tracing for --callgraph. main.cpp reports CALL / RET / IRET as
+// they retire from the write stage, and interrupt or exception entry as
+// exc_load pulses. Each call opens a frame on a shadow stack for the privilege
+// level where the callee runs. Returns close frames on the stack of the
+// current level:
+// - RET closes the top frame if it is a CALL frame.
+// - IRET closes frames up to and including the innermost INT frame.
+// A closed frame adds its cycles to the function totals.
+//
+// A function is keyed by the linear address of the first exe_eip seen after
+// the transfer, the same kind of address print_bios_calls() taps
+// (e.g. F000:85d3 for INT 13h). Exclusive time is inclusive time minus the
+// inclusive time of children, on any privilege level.
+//
+// Output file (little-endian):
+//   char     magic[8] = "AO486CG1"
+//   uint64_t total_cycles, unmatched_returns, dropped_frames
+//   uint32_t count
+//   count x { uint32_t entry; uint8_t kinds; uint8_t cpls; uint16_t pad;
+//             uint64_t calls, inclusive, exclusive; }
+// kinds: bit 0 called, bit 1 interrupt entry. cpls: bit n entered at CPL n.
+// write stage commands, from src/ao486/autogen/defines.v
+enum { CMD_CALL = 3, CMD_RET_near = 15, CMD_IRET = 35, CMD_RET_far = 63 };
+
+class CallGraph {
+public:
+    enum Kind { CALL = 1, INT = 2 };
+
+    void begin(uint64_t cycle) { start_cycle = cycle; }
+
+    // A CALL or interrupt retired, the callee is known once resolve() is called
+    void enter(Kind kind, uint32_t eip_now) {
+        pending = kind;
+        pending_eip = eip_now;
+    }
+
+    bool is_pending() const { return pending != 0; }
+    uint32_t pending_from() const { return pending_eip; }
+
+    // First instruction of the callee reached execute
+    void resolve(uint32_t entry, int cpl, uint64_t cycle) {
+        std::vector<Frame> &s = stacks[cpl & 3];
+        if (s.size() >= MAX_DEPTH) {
+            s.erase(s.begin());             // lose the oldest frame rather than the matching
+            dropped++;
+        }
+        Frame f;
+        f.entry = entry;
+        f.kind = pending;
+        f.cpl = cpl & 3;
+        f.start = cycle;
+        f.seq = ++seq;
+        innermost(f.parent_cpl, f.parent_seq);
+        s.push_back(f);
+        pending = 0;
+    }
+
+    void ret(int cpl, uint64_t cycle) {
+        std::vector<Frame> &s = stacks[cpl & 3];
+        if (s.empty() || s.back().kind != CALL) {
+            unmatched++;
+            return;
+        }
+        close(s, cycle);
+    }
+
+    void iret(int cpl, uint64_t cycle) {
+        std::vector<Frame> &s = stacks[cpl & 3];
+        size_t i = s.size();
+        while (i > 0 && s[i - 1].kind != INT) i--;
+        if (i == 0) {
+            unmatched++;
+            return;
+        }
+        while (s.size() >= i) close(s, cycle);
+    }
+
+    bool write(const char *fname, uint64_t cycle) {
+        // frames still open count up to now
+        for (int l = 0; l < 4; l++)
+            while (!stacks[l].empty()) close(stacks[l], cycle);
+        FILE *f = fopen(fname, "wb");
+        if (!f) {
+            printf("Cannot open %s for writing\n", fname);
+            return false;
+        }
+        fwrite("AO486CG1", 1, 8, f);
+        uint64_t total = cycle - start_cycle;
+        fwrite(&total, 8, 1, f);
+        fwrite(&unmatched, 8, 1, f);
+        fwrite(&dropped, 8, 1, f);
+        uint32_t n = stats.size();
+        fwrite(&n, 4, 1, f);
+        for (auto &[entry, st] : stats) {
+            Record r = {entry, st.kinds, st.cpls, 0, st.calls, st.inclusive, st.exclusive};
+            fwrite(&r, sizeof(r), 1, f);
+        }
+        fclose(f);
+        printf("Call graph: %u functions, %llu unmatched returns written to %s\n", n,
+               (unsigned long long)unmatched, fname);
+        return true;
+    }
+
+private:
+    static const size_t MAX_DEPTH = 1024;
+
+    struct Frame {
+        uint32_t entry;
+        uint8_t kind, cpl;
+        uint64_t start, children = 0, seq;
+        int parent_cpl;                     // -1: no parent
+        uint64_t parent_seq;                // not a stack index, the oldest frames may be dropped
+    };
+    struct Stats { uint8_t kinds = 0, cpls = 0; uint64_t calls = 0, inclusive = 0, exclusive = 0; };
+#pragma pack(push, 1)
+    struct Record { uint32_t entry; uint8_t kinds, cpls; uint16_t pad; uint64_t calls, inclusive, exclusive; };
+#pragma pack(pop)
+
+    // Most recently opened frame on any level
+    void innermost(int &cpl, uint64_t &frame_seq) const {
+        cpl = -1;
+        frame_seq = 0;
+        for (int l = 0; l < 4; l++)
+            if (!stacks[l].empty() && stacks[l].back().seq > frame_seq) {
+                frame_seq = stacks[l].back().seq;
+                cpl = l;
+            }
+    }
+
+    void close(std::vector<Frame> &s, uint64_t cycle) {
+        Frame f = s.back();
+        s.pop_back();
+        uint64_t incl = cycle - f.start;
+        Stats &st = stats[f.entry];
+        st.kinds |= f.kind;
+        st.cpls |= 1 << f.cpl;
+        st.calls++;
+        st.inclusive += incl;
+        st.exclusive += incl > f.children ? incl - f.children : 0;
+        if (f.parent_cpl < 0) return;
+        // seq grows from the bottom of each stack up
+        std::vector<Frame> &p = stacks[f.parent_cpl];
+        auto it = std::lower_bound(p.begin(), p.end(), f.parent_seq,
+                                   [](const Frame &a, uint64_t q) { return a.seq < q; });
+        if (it != p.end() && it->seq == f.parent_seq) it->children += incl;
+    }
+
+    std::vector<Frame> stacks[4];           // shadow call stack per privilege level
+    std::unordered_map<uint32_t, Stats> stats;
+    uint8_t pending = 0;
+    uint32_t pending_eip = 0;
+    uint64_t seq = 0, start_cycle = 0, unmatched = 0, dropped = 0;
+};
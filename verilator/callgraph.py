@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""
+Summarize a call graph written by Vsystem --callgraph
+
+Prints the top functions by inclusive cycles, exclusive cycles or call count.
+With a --symbols file (same format as the simulator's), entries are named by
+the nearest symbol at or below them, matched on the 2nd address.
+"""
+
+import argparse
+import bisect
+import struct
+import sys
+
+HEADER = struct.Struct("<8sQQQI")
+RECORD = struct.Struct("<IBBHQQQ")
+
+
+def parse_addr(s):
+    if ":" in s:
+        seg, off = s.split(":")
+        return (int(seg, 16) << 4) + int(off, 16)
+    return int(s, 16)
+
+
+def load_symbols(fname):
+    syms = {}
+    with open(fname) as f:
+        for line in f:
+            parts = line.split()
+            if len(parts) < 3:
+                continue
+            try:
+                syms[parse_addr(parts[1])] = parts[2]
+            except ValueError:
+                print("Invalid symbol address: %s" % parts[1], file=sys.stderr)
+    return sorted(syms.items())
+
+
+def name_of(entry, syms, starts):
+    i = bisect.bisect_right(starts, entry) - 1
+    if i < 0 or entry - starts[i] >= 0x10000:
+        return "%05x" % entry
+    off = entry - starts[i]
+    return syms[i][1] if off == 0 else "%s+%x" % (syms[i][1], off)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("file", help="output of --callgraph")
+    ap.add_argument("--symbols", help="symbol file, as for --symbols")
+    ap.add_argument("--sort", choices=["incl", "excl", "calls"], default="incl")
+    ap.add_argument("--top", type=int, default=30)
+    args = ap.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+    magic, total, unmatched, dropped, n = HEADER.unpack_from(data, 0)
+    if magic != b"AO486CG1":
+        sys.exit("%s: not a call graph file" % args.file)
+    rows = [RECORD.unpack_from(data, HEADER.size + i * RECORD.size) for i in range(n)]
+
+    syms = load_symbols(args.symbols) if args.symbols else []
+    starts = [a for a, _ in syms]
+    key = {"incl": 5, "excl": 6, "calls": 4}[args.sort]
+    rows.sort(key=lambda r: r[key], reverse=True)
+
+    print("%d cycles, %d functions, %d unmatched returns, %d dropped frames" % (total, n, unmatched, dropped))
+    print("%10s %14s %7s %14s %7s  %-4s %-4s %s" % ("calls", "inclusive", "%", "exclusive", "%", "kind", "cpl", "function"))
+    for entry, kinds, cpls, _, calls, incl, excl in rows[:args.top]:
+        kind = ("C" if kinds & 1 else "") + ("I" if kinds & 2 else "")
+        cpl = "".join(str(l) for l in range(4) if cpls & (1 << l))
+        print("%10d %14d %6.2f%% %14d %6.2f%%  %-4s %-4s %s" % (
+            calls, incl, 100.0 * incl / max(total, 1), excl, 100.0 * excl / max(total, 1),
+            kind, cpl, name_of(entry, syms, starts)))
+
+
+if __name__ == "__main__":
+    main()
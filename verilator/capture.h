@@ -0,0 +1,213 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include "ring.h"
+
+// Frame capture for --capture. The simulation thread only copies the visible
+// part of a finished frame and queues it. A background thread drops frames
+// that did not change (with --capture-changed) and encodes the rest, either as
+// a directory of PNG files or as one raw Y4M stream. If the encoder falls
+// behind, frames are dropped rather than waited for.
+//
+// Pixels are 32-bit words 0xRRGGBBAA (SDL_PIXELFORMAT_RGBA8888).
+class FrameCapture {
+public:
+    // Output is a Y4M stream if path ends with .y4m, otherwise a directory of
+    // frame_NNNNNN.png files, named after the simulated frame number.
+    bool open(const std::string &path, int every_n, bool changed_only) {
+        out = path;
+        every = every_n > 0 ? every_n : 1;
+        only_changed = changed_only;
+        y4m = out.size() > 4 && out.compare(out.size() - 4, 4, ".y4m") == 0;
+        if (!y4m) {
+            mkdir(out.c_str(), 0755);
+            struct stat st;
+            if (stat(out.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+                printf("Capture: %s is not a directory\n", out.c_str());
+                return false;
+            }
+        }
+        running = true;
+        th = std::thread([this] { run(); });
+        return true;
+    }
+
+    bool is_open() const { return th.joinable(); }
+
+    // Called at VSYNC with the finished frame, w x h visible out of pitch pixels per row
+    void frame(const uint32_t *pixels, int pitch, int w, int h, int frame_no) {
+        if (vsyncs++ % every != 0 || w <= 0 || h <= 0) return;
+        Frame *f = new Frame{w, h, frame_no, std::vector<uint32_t>((size_t)w * h)};
+        for (int y = 0; y < h; y++)
+            memcpy(&f->pixels[(size_t)y * w], pixels + (size_t)y * pitch, w * sizeof(uint32_t));
+        if (!queue.push(f)) {
+            delete f;
+            dropped++;
+        }
+    }
+
+    // Flush the queue and finish the output
+    void close() {
+        if (!th.joinable()) return;
+        running = false;
+        th.join();
+        if (file) fclose(file);
+        file = nullptr;
+        printf("Captured %d frames to %s (%d unchanged, %d dropped)\n", written, out.c_str(), unchanged, (int)dropped);
+    }
+
+private:
+    struct Frame {
+        int w, h, frame_no;
+        std::vector<uint32_t> pixels;
+    };
+
+    void run() {
+        for (;;) {
+            Frame *f;
+            if (!queue.pop(f)) {
+                if (!running) break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                continue;
+            }
+            if (only_changed && last && last->w == f->w && last->h == f->h && last->pixels == f->pixels) {
+                unchanged++;
+                delete f;
+                continue;
+            }
+            if (y4m) write_y4m(*f); else write_png(*f);
+            written++;
+            delete last;
+            last = f;
+        }
+        delete last;
+        last = nullptr;
+    }
+
+    // Raw YUV 4:4:4 (BT.601), a resolution change starts a new file <name>_N.y4m
+    void write_y4m(const Frame &f) {
+        if (!file || f.w != y4m_w || f.h != y4m_h) {
+            if (file) fclose(file);
+            std::string name = out;
+            if (y4m_segment > 0)
+                name = out.substr(0, out.size() - 4) + "_" + std::to_string(y4m_segment) + ".y4m";
+            y4m_segment++;
+            file = fopen(name.c_str(), "wb");
+            if (!file) {
+                printf("Capture: cannot open %s\n", name.c_str());
+                return;
+            }
+            y4m_w = f.w; y4m_h = f.h;
+            fprintf(file, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C444\n", f.w, f.h);
+        }
+        size_t n = (size_t)f.w * f.h;
+        std::vector<uint8_t> yuv(n * 3);
+        for (size_t i = 0; i < n; i++) {
+            int r = f.pixels[i] >> 24, g = f.pixels[i] >> 16 & 0xff, b = f.pixels[i] >> 8 & 0xff;
+            yuv[i]         = (uint8_t)(( 66 * r + 129 * g +  25 * b + 128) / 256 + 16);
+            yuv[n + i]     = (uint8_t)((-38 * r -  74 * g + 112 * b + 128) / 256 + 128);
+            yuv[2 * n + i] = (uint8_t)((112 * r -  94 * g -  18 * b + 128) / 256 + 128);
+        }
+        fputs("FRAME\n", file);
+        fwrite(yuv.data(), 1, yuv.size(), file);
+    }
+
+    // RGB PNG with stored (uncompressed) deflate blocks, so no zlib is needed
+    void write_png(const Frame &f) {
+        char name[32];
+        snprintf(name, sizeof(name), "/frame_%06d.png", f.frame_no);
+        FILE *png = fopen((out + name).c_str(), "wb");
+        if (!png) {
+            printf("Capture: cannot open %s%s\n", out.c_str(), name);
+            return;
+        }
+        std::vector<uint8_t> raw;                   // filter byte + RGB per row
+        raw.reserve((size_t)f.h * (1 + f.w * 3));
+        for (int y = 0; y < f.h; y++) {
+            raw.push_back(0);
+            for (int x = 0; x < f.w; x++) {
+                uint32_t p = f.pixels[(size_t)y * f.w + x];
+                raw.push_back(p >> 24); raw.push_back(p >> 16); raw.push_back(p >> 8);
+            }
+        }
+
+        std::vector<uint8_t> z = {0x78, 0x01};
+        uint32_t a = 1, b = 0;                      // adler32
+        size_t pos = 0;
+        do {
+            uint16_t len = std::min<size_t>(65535, raw.size() - pos);
+            z.push_back(pos + len == raw.size());   // BFINAL, BTYPE=00
+            z.push_back(len & 0xff); z.push_back(len >> 8);
+            z.push_back(~len & 0xff); z.push_back((~len >> 8) & 0xff);
+            z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + len);
+            for (size_t i = pos; i < pos + len; i++) {
+                a = (a + raw[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+            pos += len;
+        } while (pos < raw.size());
+        put32(z, b << 16 | a);
+
+        static const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        fwrite(sig, 1, 8, png);
+        std::vector<uint8_t> ihdr;
+        put32(ihdr, f.w); put32(ihdr, f.h);
+        ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});   // 8-bit RGB
+        chunk(png, "IHDR", ihdr);
+        chunk(png, "IDAT", z);
+        chunk(png, "IEND", {});
+        fclose(png);
+    }
+
+    static void put32(std::vector<uint8_t> &v, uint32_t x) {
+        v.push_back(x >> 24); v.push_back(x >> 16); v.push_back(x >> 8); v.push_back(x);
+    }
+
+    static void chunk(FILE *f, const char type[4], const std::vector<uint8_t> &data) {
+        std::vector<uint8_t> buf;
+        put32(buf, data.size());
+        buf.insert(buf.end(), type, type + 4);
+        buf.insert(buf.end(), data.begin(), data.end());
+        put32(buf, crc32(buf.data() + 4, buf.size() - 4));
+        fwrite(buf.data(), 1, buf.size(), f);
+    }
+
+    static uint32_t crc32(const uint8_t *p, size_t n) {
+        static uint32_t table[256];
+        if (!table[1]) {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                table[i] = c;
+            }
+        }
+        uint32_t c = 0xffffffff;
+        for (size_t i = 0; i < n; i++) c = table[(c ^ p[i]) & 0xff] ^ (c >> 8);
+        return c ^ 0xffffffff;
+    }
+
+    std::string out;
+    int every = 1;
+    bool only_changed = false;
+    bool y4m = false;
+    uint64_t vsyncs = 0;
+
+    std::thread th;
+    std::atomic<bool> running{false};
+    SpscRing<Frame *, 16> queue;
+    std::atomic<int> dropped{0};
+
+    // encoder thread only
+    Frame *last = nullptr;
+    int written = 0, unchanged = 0;
+    FILE *file = nullptr;
+    int y4m_w = 0, y4m_h = 0, y4m_segment = 0;
+};
@@ -0,0 +1,137 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <svdpi.h>
+#include "Vsystem_vga.h"
+
+extern "C" int vga_text_read(int addr);     // exported by vga.v
+
+// Text screen for --console. At each VSYNC in a text mode the character
+// buffer is read out of the VGA plane RAM (characters in plane 0, attributes
+// in plane 1) the way the CRTC scans it: from the start address, offset
+// register words per row, with the word, byte or doubleword address rotation
+// of vga.v (see plane_address()). Only rows that
+// changed since the last frame are written, as UTF-8 with ANSI colors, one
+// "<time>: CON <row>: <text>" line each. Graphics modes give a single line when
+// they are entered.
+class TextConsole {
+public:
+    // fname empty: stdout
+    bool open(const std::string &fname, svScope vga_scope) {
+        scope = vga_scope;
+        if (!scope) {
+            printf("--console: VGA scope not found\n");
+            return false;
+        }
+        if (fname.empty()) return true;
+        f = fopen(fname.c_str(), "w");
+        if (!f) {
+            perror(fname.c_str());
+            f = stdout;
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (f != stdout) fclose(f);
+        f = stdout;
+    }
+
+    void frame(const Vsystem_vga &v, long long time) {
+        if (v.attrib_graphic_mode) {
+            if (!graphics) fprintf(f, "%8lld: CON: graphics mode\n", time);
+            graphics = true;
+            return;
+        }
+        int c = std::min(v.crtc_horizontal_display_size + 1, MAX_COLS);
+        int r = std::min((v.crtc_vertical_display_size + 1) / (v.crtc_row_max + 1), MAX_ROWS);
+        if (graphics || c != cols || r != rows) {
+            cols = c;
+            rows = r;
+            screen.assign(cols * rows, 0xffff);     // print everything
+            graphics = false;
+        }
+        svScope prev = svSetScope(scope);
+        uint32_t start = v.crtc_address_start & 0xffff, stride = v.crtc_address_offset * 2;
+        std::vector<uint16_t> row(cols);
+        for (int y = 0; y < rows; y++) {
+            bool changed = false;
+            for (int x = 0; x < cols; x++) {
+                row[x] = vga_text_read(plane_address(v, (start + y * stride + x) & 0xffff)) & 0xffff;
+                changed |= row[x] != screen[y * cols + x];
+            }
+            if (!changed) continue;
+            std::copy(row.begin(), row.end(), screen.begin() + y * cols);
+            print_row(time, y, row);
+        }
+        svSetScope(prev);
+    }
+
+private:
+    static constexpr int MAX_COLS = 256, MAX_ROWS = 128;
+
+    // vga.v memory_address_step_1/step_2 for the first scan line of a row
+    static uint32_t plane_address(const Vsystem_vga &v, uint32_t a) {
+        if (v.crtc_address_doubleword) a = (a << 2 | a >> 14) & 0xffff;
+        else if (!v.crtc_address_byte) a = (a << 1 | (a >> (v.crtc_address_bit0 ? 15 : 13) & 1)) & 0xffff;
+        if (!v.crtc_address_bit14) a &= ~0x4000u;   // row scan bit 1
+        if (!v.crtc_address_bit13) a &= ~0x2000u;   // row scan bit 0
+        return a;
+    }
+
+    void print_row(long long time, int y, const std::vector<uint16_t> &row) {
+        static const int ansi[8] = {0, 4, 2, 6, 1, 5, 3, 7};    // VGA to ANSI color order
+        int len = cols;
+        while (len > 0 && (row[len - 1] & 0xff) <= ' ' && !(row[len - 1] & 0x7000)) len--;   // blank on black
+        std::string s;
+        int attr = -1;
+        for (int x = 0; x < len; x++) {
+            uint8_t ch = row[x] & 0xff, a = row[x] >> 8;
+            if (a != attr) {
+                char sgr[24];
+                snprintf(sgr, sizeof(sgr), "\033[%d;%dm", (a & 8 ? 90 : 30) + ansi[a & 7], 40 + ansi[a >> 4 & 7]);
+                s += sgr;
+                attr = a;
+            }
+            append_char(s, ch);
+        }
+        fprintf(f, "%8lld: CON %2d: %s\033[0m\n", time, y, s.c_str());
+    }
+
+    // code page 437 to UTF-8, control characters as '.'
+    static void append_char(std::string &s, uint8_t ch) {
+        static const uint16_t high[128] = {
+            0x00c7, 0x00fc, 0x00e9, 0x00e2, 0x00e4, 0x00e0, 0x00e5, 0x00e7, 0x00ea, 0x00eb, 0x00e8, 0x00ef, 0x00ee, 0x00ec, 0x00c4, 0x00c5,
+            0x00c9, 0x00e6, 0x00c6, 0x00f4, 0x00f6, 0x00f2, 0x00fb, 0x00f9, 0x00ff, 0x00d6, 0x00dc, 0x00a2, 0x00a3, 0x00a5, 0x20a7, 0x0192,
+            0x00e1, 0x00ed, 0x00f3, 0x00fa, 0x00f1, 0x00d1, 0x00aa, 0x00ba, 0x00bf, 0x2310, 0x00ac, 0x00bd, 0x00bc, 0x00a1, 0x00ab, 0x00bb,
+            0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556, 0x2555, 0x2563, 0x2551, 0x2557, 0x255d, 0x255c, 0x255b, 0x2510,
+            0x2514, 0x2534, 0x252c, 0x251c, 0x2500, 0x253c, 0x255e, 0x255f, 0x255a, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256c, 0x2567,
+            0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256b, 0x256a, 0x2518, 0x250c, 0x2588, 0x2584, 0x258c, 0x2590, 0x2580,
+            0x03b1, 0x00df, 0x0393, 0x03c0, 0x03a3, 0x03c3, 0x00b5, 0x03c4, 0x03a6, 0x0398, 0x03a9, 0x03b4, 0x221e, 0x03c6, 0x03b5, 0x2229,
+            0x2261, 0x00b1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00f7, 0x2248, 0x00b0, 0x2219, 0x00b7, 0x221a, 0x207f, 0x00b2, 0x25a0, 0x00a0};
+        if (ch == 0) s += ' ';
+        else if (ch < 32 || ch == 127) s += '.';
+        else if (ch < 128) s += (char)ch;
+        else {
+            uint16_t u = high[ch - 128];
+            if (u < 0x800) {
+                s += (char)(0xc0 | u >> 6);
+                s += (char)(0x80 | (u & 0x3f));
+            } else {
+                s += (char)(0xe0 | u >> 12);
+                s += (char)(0x80 | (u >> 6 & 0x3f));
+                s += (char)(0x80 | (u & 0x3f));
+            }
+        }
+    }
+
+    svScope scope = nullptr;
+    FILE *f = stdout;
+    std::vector<uint16_t> screen;       // last output, character | attribute << 8
+    int cols = 0, rows = 0;
+    bool graphics = false;
+};
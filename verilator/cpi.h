@@ -0,0 +1,128 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Cycles per instruction by opcode for --cpi. An instruction retires when
+// the write stage finishes it (wr_finished, not in the middle of a REP
+// string), and gets the clk_sys cycles since the previous retirement. So
+// pipeline stalls, cache misses and interrupt entry are charged to the
+// instruction that waited for them, and a REP string counts once with all
+// its iterations.
+//
+// Instructions are classified by opcode (0F xx for two-byte), ModRM form
+// (register or memory operand, plus the reg field for group opcodes like
+// 80-83 or F6/F7), REP/LOCK prefixes and operand/address size. The table is
+// written sorted by class, so two runs of the same workload diff line by line
+// (see cpi_diff.py).
+class CpiProfile {
+public:
+    // decoder is wr_decoder: opcode in [7:0] and ModRM in [15:8], prefixes
+    // and the 0F byte already consumed
+    static uint32_t classify(bool two_byte, uint16_t decoder, unsigned rep, bool lock, bool o32, bool a32) {
+        uint8_t op = decoder & 0xff, modrm = decoder >> 8;
+        uint32_t key = op | two_byte << 8 | rep << 15 | lock << 17 | o32 << 18;
+        if (has_modrm(two_byte, op)) {
+            bool mem = (modrm >> 6) != 3;
+            key |= (mem ? 2 : 1) << 9;
+            if (is_group(two_byte, op)) key |= (((modrm >> 3) & 7) + 1) << 11;
+            if (mem) key |= a32 << 19;
+        }
+        return key;
+    }
+
+    void retire(uint32_t key, uint64_t cycle) {
+        if (last_cycle != UINT64_MAX) {
+            Row &r = rows[key];
+            uint64_t n = cycle - last_cycle;
+            r.count++;
+            r.cycles += n;
+            r.max = std::max(r.max, n);
+            instructions++;
+            cycles += n;
+        }
+        last_cycle = cycle;
+    }
+
+    bool write(const char *fname) const {
+        FILE *f = fopen(fname, "w");
+        if (!f) {
+            printf("Cannot open %s for writing\n", fname);
+            return false;
+        }
+        std::vector<uint32_t> keys;
+        for (auto &it : rows) keys.push_back(it.first);
+        std::sort(keys.begin(), keys.end(), [](uint32_t a, uint32_t b) { return name(a) < name(b); });
+        fprintf(f, "# %llu instructions, %llu cycles, CPI %.3f\n", (unsigned long long)instructions,
+                (unsigned long long)cycles, instructions ? (double)cycles / instructions : 0);
+        fprintf(f, "# %-6s %-5s %-16s %12s %14s %8s %6s\n", "opcode", "modrm", "prefix", "count", "cycles", "mean", "max");
+        for (uint32_t k : keys) {
+            const Row &r = rows.at(k);
+            fprintf(f, "%s %12llu %14llu %8.2f %6llu\n", name(k).c_str(), (unsigned long long)r.count,
+                    (unsigned long long)r.cycles, (double)r.cycles / r.count, (unsigned long long)r.max);
+        }
+        fclose(f);
+        return true;
+    }
+
+    // Top classes by total cycles
+    void report(FILE *f, int top_n) const {
+        std::vector<std::pair<uint64_t, uint32_t>> v;
+        for (auto &it : rows) v.push_back({it.second.cycles, it.first});
+        std::sort(v.begin(), v.end(), std::greater<>());
+        fprintf(f, "CPI: %llu instructions, %llu cycles, CPI %.3f\n", (unsigned long long)instructions,
+                (unsigned long long)cycles, instructions ? (double)cycles / instructions : 0);
+        for (int i = 0; i < (int)v.size() && i < top_n; i++) {
+            const Row &r = rows.at(v[i].second);
+            fprintf(f, "  %s %6.2f%% of cycles, CPI %.2f\n", name(v[i].second).c_str(), 100.0 * r.cycles / cycles,
+                    (double)r.cycles / r.count);
+        }
+    }
+
+    // Fixed-width "opcode modrm prefix" columns, e.g. "0FB6   m     o16,a16"
+    static std::string name(uint32_t key) {
+        char op[8], modrm[8] = "-", prefix[32] = "";
+        snprintf(op, sizeof(op), (key >> 8 & 1) ? "0F%02X" : "%02X", key & 0xff);
+        unsigned form = key >> 9 & 3, group = key >> 11 & 15;
+        const char *mr = form == 2 ? "m" : "r";
+        if (form && group) snprintf(modrm, sizeof(modrm), "/%u%s", group - 1, mr);
+        else if (form) snprintf(modrm, sizeof(modrm), "%s", mr);
+        unsigned rep = key >> 15 & 3;
+        snprintf(prefix, sizeof(prefix), "%s%s%s%s", key >> 18 & 1 ? "o32" : "o16",
+                 form == 2 ? (key >> 19 & 1 ? ",a32" : ",a16") : "",
+                 rep == 1 ? ",repne" : rep == 2 ? ",rep" : "", key >> 17 & 1 ? ",lock" : "");
+        char buf[64];
+        snprintf(buf, sizeof(buf), "  %-6s %-5s %-16s", op, modrm, prefix);
+        return buf;
+    }
+
+private:
+    struct Row {
+        uint64_t count = 0, cycles = 0, max = 0;
+    };
+
+    // One bit per opcode, from the 386 opcode maps
+    static bool has_modrm(bool two_byte, uint8_t op) {
+        static const uint32_t one[8] = {0x0f0f0f0f, 0x0f0f0f0f, 0x00000000, 0x00000a0c,
+                                        0x0000ffff, 0x00000000, 0xff0f00f3, 0xc0c00000};
+        static const uint32_t two[8] = {0x0000000f, 0x0000000f, 0x00000000, 0x00000000,
+                                        0xffff0000, 0xfcffb838, 0x00000003, 0x00000000};
+        const uint32_t *t = two_byte ? two : one;
+        return t[op >> 5] >> (op & 31) & 1;
+    }
+
+    // the ModRM reg field selects the operation
+    static bool is_group(bool two_byte, uint8_t op) {
+        if (two_byte) return op == 0x00 || op == 0x01 || op == 0xba;
+        return (op >= 0x80 && op <= 0x83) || op == 0x8f || op == 0xc0 || op == 0xc1 || op == 0xc6 || op == 0xc7 ||
+               (op >= 0xd0 && op <= 0xd3) || (op >= 0xd8 && op <= 0xdf) || op == 0xf6 || op == 0xf7 ||
+               op == 0xfe || op == 0xff;
+    }
+
+    std::unordered_map<uint32_t, Row> rows;
+    uint64_t last_cycle = UINT64_MAX;
+    uint64_t instructions = 0, cycles = 0;
+};
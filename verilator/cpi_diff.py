@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""
+Compare two CPI tables written by Vsystem --cpi
+
+Runs of the same workload on two RTL revisions are matched by instruction
+class (opcode, ModRM form, prefixes). Classes are listed by the change in
+total cycles, largest first, with the mean CPI before and after.
+"""
+
+import argparse
+import sys
+
+
+def load(fname):
+    rows, total = {}, None
+    with open(fname) as f:
+        for line in f:
+            parts = line.split()
+            if line.startswith("#"):
+                if len(parts) > 4 and parts[2] == "instructions,":
+                    total = (int(parts[1]), int(parts[3]))
+                continue
+            if len(parts) != 7:
+                continue
+            rows[tuple(parts[:3])] = (int(parts[3]), int(parts[4]), int(parts[6]))
+    if total is None:
+        print("%s: not a --cpi table" % fname, file=sys.stderr)
+        sys.exit(1)
+    return rows, total
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("before")
+    ap.add_argument("after")
+    ap.add_argument("-n", "--top", type=int, default=30, help="number of classes to show (default 30)")
+    args = ap.parse_args()
+
+    a, (a_ins, a_cyc) = load(args.before)
+    b, (b_ins, b_cyc) = load(args.after)
+    print("instructions %d -> %d, cycles %d -> %d (%+.2f%%), CPI %.3f -> %.3f" % (
+        a_ins, b_ins, a_cyc, b_cyc, 100.0 * (b_cyc - a_cyc) / a_cyc if a_cyc else 0,
+        a_cyc / a_ins if a_ins else 0, b_cyc / b_ins if b_ins else 0))
+
+    rows = []
+    for key in set(a) | set(b):
+        an, ac, _ = a.get(key, (0, 0, 0))
+        bn, bc, _ = b.get(key, (0, 0, 0))
+        rows.append((bc - ac, key, an, ac, bn, bc))
+    rows.sort(key=lambda r: -abs(r[0]))
+
+    print("%-6s %-5s %-16s %12s %12s %8s %8s %12s" % ("opcode", "modrm", "prefix", "count", "count'", "CPI",
+                                                     "CPI'", "d cycles"))
+    for delta, key, an, ac, bn, bc in rows[:args.top]:
+        print("%-6s %-5s %-16s %12d %12d %8s %8s %+12d" % (key + (an, bn,
+              "%.2f" % (ac / an) if an else "-", "%.2f" % (bc / bn) if bn else "-", delta)))
+
+
+if __name__ == "__main__":
+    main()
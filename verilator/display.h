@@ -0,0 +1,139 @@
+#pragma once
+#include <SDL.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include "ring.h"
+
+// SDL window, with the simulation on a worker thread. All SDL video and event
+// calls stay on the main thread, which macOS requires, and the simulation
+// never blocks on the host display refresh or on the window system:
+// - Frames: the simulation draws into a back buffer and offers it with
+//   present() at VSYNC. If the main thread is still busy with the previous
+//   frame, the offer is refused and the simulation keeps drawing into the same
+//   buffer, i.e. the frame is dropped instead of waited for.
+// - Input: every SDL event is drained on the main thread and the ones the
+//   simulation cares about are queued for poll().
+class Display {
+public:
+    struct Event {
+        enum Type { KEY_DOWN, KEY_UP, QUIT } type;
+        SDL_Keycode sym;
+        uint16_t mod;
+    };
+
+    // Open the window from the main thread, returns false if SDL could not be
+    // set up. Frames are w x h pixels of 4 bytes in SDL_PIXELFORMAT_RGBA8888.
+    bool start(int w, int h) {
+        width = w; height = h;
+        if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+            printf("SDL init failed.\n");
+            return false;
+        }
+        window = SDL_CreateWindow("z86 sim", SDL_WINDOWPOS_CENTERED,
+                                  SDL_WINDOWPOS_CENTERED, 800, 600, SDL_WINDOW_SHOWN);
+        if (!window) {
+            printf("Window creation failed: %s\n", SDL_GetError());
+            return false;
+        }
+        renderer = SDL_CreateRenderer(window, -1,
+                                      SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        if (!renderer) {
+            printf("Renderer creation failed: %s\n", SDL_GetError());
+            return false;
+        }
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                                    SDL_TEXTUREACCESS_TARGET, width, height);
+        if (!texture) {
+            printf("Texture creation failed: %s\n", SDL_GetError());
+            return false;
+        }
+        SDL_RenderClear(renderer);
+        SDL_RenderPresent(renderer);
+        SDL_StopTextInput(); // for SDL_KEYDOWN
+        return true;
+    }
+
+    // Run sim on a worker thread while the calling (main) thread shows its
+    // frames and collects input. Returns when sim does.
+    void run(const std::function<void()> &sim) {
+        running = true;
+        std::thread th([&] {
+            sim();
+            running = false;
+        });
+        while (running) {
+            SDL_Event e;
+            // wait a little for input when there is no frame to show
+            if (frame_ready.load(std::memory_order_acquire) ? SDL_PollEvent(&e) : SDL_WaitEventTimeout(&e, 5)) {
+                do handle(e); while (SDL_PollEvent(&e));
+            }
+            if (frame_ready.load(std::memory_order_acquire)) {
+                // the texture keeps its own copy, so the frame is released
+                // before the (possibly vsync-blocking) present
+                SDL_UpdateTexture(texture, NULL, pending, width * 4);
+                SDL_Rect r = src;
+                SDL_SetWindowTitle(window, title);
+                frame_ready.store(false, std::memory_order_release);
+                SDL_RenderClear(renderer);
+                SDL_RenderCopy(renderer, texture, &r, NULL);
+                SDL_RenderPresent(renderer);
+            }
+        }
+        th.join();
+    }
+
+    // Main thread, after run()
+    void stop() {
+        if (texture) SDL_DestroyTexture(texture);
+        if (renderer) SDL_DestroyRenderer(renderer);
+        if (window) SDL_DestroyWindow(window);
+        texture = nullptr;
+        renderer = nullptr;
+        window = nullptr;
+        SDL_Quit();
+    }
+
+    // Offer a finished frame showing its top-left res_x x res_y pixels. Returns
+    // true if it was taken, then the main thread owns it until it is done
+    // and the caller must draw the next frame into its other buffer.
+    bool present(const void *frame, int res_x, int res_y, const char *window_title) {
+        if (frame_ready.load(std::memory_order_acquire)) return false;
+        pending = frame;
+        src = {0, 0, res_x, res_y};
+        snprintf(title, sizeof(title), "%s", window_title);
+        frame_ready.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // Next input event, false if there is none
+    bool poll(Event &e) { return events.pop(e); }
+
+private:
+    void handle(const SDL_Event &e) {
+        if (e.type == SDL_QUIT ||
+            e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_CLOSE && e.window.windowID == SDL_GetWindowID(window)) {
+            // the simulation waits for this one, retry until there is room
+            while (!events.push({Event::QUIT, 0, 0}) && running) SDL_Delay(1);
+        } else if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) {
+            // dropped if the simulation is too far behind
+            events.push({e.type == SDL_KEYDOWN ? Event::KEY_DOWN : Event::KEY_UP, e.key.keysym.sym, e.key.keysym.mod});
+        }
+    }
+
+    int width = 0, height = 0;
+    std::atomic<bool> running{false};       // sim is still going
+    SDL_Window *window = nullptr;
+    SDL_Renderer *renderer = nullptr;
+    SDL_Texture *texture = nullptr;
+
+    // frame handoff, written by present() only while frame_ready is false
+    std::atomic<bool> frame_ready{false};
+    const void *pending = nullptr;
+    SDL_Rect src = {0, 0, 0, 0};
+    char title[128] = "";
+
+    SpscRing<Event, 256> events;
+};
@@ -0,0 +1,169 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "ring.h"
+
+// Binary log of the console trace events for --event-log. The simulation
+// thread puts fixed-size records into a lock-free ring and a writer thread
+// drains it to the file, so the main loop never formats text or waits on
+// stdout. format_event() turns a record into the exact line the simulator
+// prints without --event-log, and the eventlog tool uses it to decode a log.
+//
+// File: "AO486EV1" magic, then EventRecord structs, little-endian.
+
+enum EventType : uint8_t {
+    EVT_VSYNC = 1,      // port: CS, eip: IP, data: pix_cnt, aux: width | height << 16, flags: speaker on
+    EVT_KEY_PRESSED,    // data: SDL key
+    EVT_KBD_SEND,       // data: scancode
+    EVT_KBD_COMMAND,    // data: command
+    EVT_KBD_RESET,
+    EVT_IDE,            // port, data: byte written
+    EVT_SB_WRITE,       // port, data: byte written
+    EVT_SB_READ,        // port, data: byte read
+    EVT_SB_IRQ,         // port: IRQ 5 or 7, data: asserted
+    EVT_VIDEO,          // port: 3C8/3C9, data: byte written
+    EVT_CRTC,           // port: register, data: value, aux: EAX
+    EVT_PRINT,          // data: INT 10h teletype character, flags: starts a PRINT: line
+    EVT_INT13,          // data: AX | CX << 16, aux: DX
+    EVT_INT15,          // data: AX | CX << 16, aux: DX
+    EVT_BIOS_DEBUG,     // data: character on port 8888
+    EVT_POST,           // data: POST code
+};
+
+struct EventRecord {
+    uint64_t time;
+    uint8_t type, flags;
+    uint16_t port;
+    uint32_t data, eip, aux;
+};
+static_assert(sizeof(EventRecord) == 24, "EventRecord layout");
+
+static const char EVENT_LOG_MAGIC[8] = {'A', 'O', '4', '8', '6', 'E', 'V', '1'};
+
+inline const char *sb_port_name(uint16_t port, bool write) {
+    switch (port) {
+    case 0x220: return " (FM Left)";
+    case 0x221: return " (FM Right)";
+    case 0x222: return " (FM Status/Timer)";
+    case 0x223: return write ? " (FM Timer)" : "";
+    case 0x224: return " (Mixer Index)";
+    case 0x225: return " (Mixer Data)";
+    case 0x226: return write ? " (DSP Reset)" : "";
+    case 0x228: return " (FM Status)";
+    case 0x229: return write ? " (FM Register)" : "";
+    case 0x22A: return " (DSP Read Data)";
+    case 0x22C: return write ? " (DSP Write Data/Command)" : " (DSP Write Status)";
+    case 0x22E: return " (DSP Data Available)";
+    case 0x22F: return " (DSP IRQ 16-bit)";
+    }
+    return "";
+}
+
+// Text of a record as printed to the console, returns its length
+inline int format_event(const EventRecord &e, char *buf, size_t n) {
+    long long t = e.time;
+    switch (e.type) {
+    case EVT_VSYNC:
+        return snprintf(buf, n, "%8lld: VSYNC: pix_cnt=%d, width=%d, height=%d, speaker=%s, CS:IP=%04x:%04x\n", t,
+                        (int)e.data, (int)(e.aux & 0xffff), (int)(e.aux >> 16), e.flags ? "ON" : "OFF", e.port, e.eip);
+    case EVT_KEY_PRESSED:
+        return snprintf(buf, n, "Key pressed: %d\n", (int)e.data);
+    case EVT_KBD_SEND:
+        return snprintf(buf, n, "%8lld: Sending scancode %d\n", t, (int)e.data);
+    case EVT_KBD_COMMAND:
+        return snprintf(buf, n, "%8lld: Received keyboard command %d\n", t, (int)e.data);
+    case EVT_KBD_RESET:
+        return snprintf(buf, n, "%8lld: Keyboard reset\n", t);
+    case EVT_IDE:
+        return snprintf(buf, n, "%8lld: IDE [%04x]=%02x, EIP=%08x\n", t, e.port, e.data, e.eip);
+    case EVT_SB_WRITE:
+        return snprintf(buf, n, "%8lld: SB_WR [%04x]=%02x%s, EIP=%08x\n", t, e.port, e.data, sb_port_name(e.port, true), e.eip);
+    case EVT_SB_READ:
+        return snprintf(buf, n, "%8lld: SB_RD [%04x]=%02x%s, EIP=%08x\n", t, e.port, e.data, sb_port_name(e.port, false), e.eip);
+    case EVT_SB_IRQ:
+        return snprintf(buf, n, "%8lld: SB_IRQ%d %s, EIP=%08x\n", t, e.port, e.data ? "ASSERTED" : "CLEARED", e.eip);
+    case EVT_VIDEO:
+        return snprintf(buf, n, "%8lld: VIDEO [%04x]=%02x, EIP=%08x\n", t, e.port, e.data, e.eip);
+    case EVT_CRTC:
+        return snprintf(buf, n, "%8lld: CRTC [%02x]=%02x, EIP=%08x, EAX=%08x\n", t, e.port, e.data, e.eip, e.aux);
+    case EVT_PRINT:
+        if (e.flags) {
+            int k = snprintf(buf, n, "%8lld: PRINT: ", t);
+            return k + snprintf(buf + k, n - k, "\033[32m%c\033[0m", (char)e.data);
+        }
+        return snprintf(buf, n, "\033[32m%c\033[0m", (char)e.data);
+    case EVT_INT13: {
+        unsigned ax = e.data & 0xffff, cx = e.data >> 16, dx = e.aux & 0xffff;
+        return snprintf(buf, n, "%8lld: INT 13h: AX=%04x, CX=%04x, DX=%04x, C/H/S = %d/%d/%d, count=%d\n", t, ax, cx, dx,
+                        (cx >> 8 & 0xff) + ((cx & 0xc0) << 2), dx >> 8 & 0xff, cx & 0x3f, ax & 0xff);
+    }
+    case EVT_INT15:
+        return snprintf(buf, n, "%8lld: INT 15h: AX=%04x, CX=%04x, DX=%04x\n", t, e.data & 0xffff, e.data >> 16, e.aux & 0xffff);
+    case EVT_BIOS_DEBUG:
+        return snprintf(buf, n, "\033[33m%c\033[0m", (char)e.data);
+    case EVT_POST:
+        return snprintf(buf, n, "\033[35mPOST: %02x\n\033[0m", e.data);
+    }
+    return snprintf(buf, n, "%8lld: unknown event %d\n", t, e.type);
+}
+
+class EventLog {
+public:
+    ~EventLog() { close(); }
+
+    bool open(const char *fname) {
+        f = fopen(fname, "wb");
+        if (!f) {
+            perror(fname);
+            return false;
+        }
+        fwrite(EVENT_LOG_MAGIC, 1, sizeof(EVENT_LOG_MAGIC), f);
+        running = true;
+        writer = std::thread([this] { drain(); });
+        return true;
+    }
+
+    bool is_open() const { return f != nullptr; }
+
+    // Simulation thread. Only waits if the writer is a whole ring behind.
+    void add(const EventRecord &e) {
+        while (!ring.push(e)) {
+            stalls++;
+            std::this_thread::yield();
+        }
+        count++;
+    }
+
+    void close() {
+        if (!f) return;
+        running = false;
+        writer.join();
+        fclose(f);
+        f = nullptr;
+    }
+
+    uint64_t count = 0;                 // records logged
+    uint64_t stalls = 0;                // add() found the ring full
+
+private:
+    void drain() {
+        static const int BATCH = 4096;
+        EventRecord batch[BATCH];
+        for (;;) {
+            bool stopping = !running;   // read before popping, so nothing is left behind
+            int n = 0;
+            while (n < BATCH && ring.pop(batch[n])) n++;
+            if (n) fwrite(batch, sizeof(EventRecord), n, f);
+            else if (stopping) break;
+            else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    FILE *f = nullptr;
+    SpscRing<EventRecord, 1 << 16> ring;
+    std::thread writer;
+    std::atomic<bool> running{false};
+};
@@ -0,0 +1,38 @@
+// Print a --event-log file in the simulator's console format.
+//
+//   ./eventlog sim.evlog [from [to]]
+//
+// from/to limit the output to a sim_time range.
+#include <cstdlib>
+#include <cstring>
+#include "event_log.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <event log> [from [to]]\n", argv[0]);
+        return 1;
+    }
+    uint64_t from = argc > 2 ? strtoull(argv[2], nullptr, 0) : 0;
+    uint64_t to = argc > 3 ? strtoull(argv[3], nullptr, 0) : UINT64_MAX;
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        perror(argv[1]);
+        return 1;
+    }
+    char magic[sizeof(EVENT_LOG_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, EVENT_LOG_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s: not an event log\n", argv[1]);
+        return 1;
+    }
+    EventRecord batch[4096];
+    char line[256];
+    size_t n;
+    while ((n = fread(batch, sizeof(EventRecord), 4096, f)) > 0)
+        for (size_t i = 0; i < n; i++)
+            if (batch[i].time >= from && batch[i].time <= to) {
+                format_event(batch[i], line, sizeof(line));
+                fputs(line, stdout);
+            }
+    fclose(f);
+    return 0;
+}
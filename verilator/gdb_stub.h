@@ -0,0 +1,294 @@
+#pragma once
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+
+// GDB remote serial protocol server for --gdb. It speaks the i386 register
+// layout (eax ecx edx ebx esp ebp esi edi eip eflags cs ss ds es fs gs) and
+// handles these packets:
+// - ? g p m M: stop reason, registers and memory
+// - c s: continue and single step
+// - bc bs: reverse continue and reverse step, if `reverse` is set (--rewind)
+// - Z0-Z4 z0-z4: breakpoints and watchpoints
+// - D k: detach and kill
+// Register writes are refused because the registers live in RTL flops.
+//
+// The simulation calls stopped() at an instruction boundary. stopped() serves
+// packets until GDB resumes and returns what to do next. Between stops the
+// only costs are breakpoint() per retired instruction and interrupted(), which
+// polls for Ctrl-C, every so often.
+class GdbStub {
+public:
+    // Access to the simulated machine, implemented in main.cpp
+    struct Target {
+        virtual void read_regs(uint32_t regs[16]) = 0;
+        virtual size_t read_mem(uint32_t addr, void *buf, size_t len) = 0;
+        virtual size_t write_mem(uint32_t addr, const void *buf, size_t len) = 0;
+        // type 2: write, 3: read, 4: access watchpoint
+        virtual bool watch(int type, uint32_t addr, uint32_t len, bool insert) = 0;
+    };
+
+    enum Resume { CONTINUE, STEP, REVERSE_CONTINUE, REVERSE_STEP, DETACH, KILL };
+
+    bool reverse = false;               // the target can run backwards
+
+    // Listen on localhost:port and wait for GDB to connect
+    bool start(int port, Target *t) {
+        target = t;
+        int s = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in sa = {};
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sa.sin_port = htons(port);
+        if (s < 0 || bind(s, (sockaddr *)&sa, sizeof(sa)) < 0 || listen(s, 1) < 0) {
+            printf("Cannot listen on port %d: %s\n", port, strerror(errno));
+            if (s >= 0) close(s);
+            return false;
+        }
+        printf("Waiting for GDB on localhost:%d (target remote :%d)\n", port, port);
+        fd = accept(s, nullptr, nullptr);
+        close(s);
+        if (fd < 0) {
+            printf("GDB accept failed: %s\n", strerror(errno));
+            return false;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        printf("GDB connected\n");
+        return true;
+    }
+
+    bool connected() const { return fd >= 0; }
+
+    bool breakpoint(uint32_t pc) const { return !breakpoints.empty() && breakpoints.count(pc); }
+
+    // Ctrl-C from GDB while running
+    bool interrupted() {
+        if (fd < 0) return false;
+        uint8_t c;
+        while (recv(fd, &c, 1, MSG_DONTWAIT) == 1)
+            if (c == 0x03) return true;
+        return false;
+    }
+
+    // Report a stop ("T05", "T05watch:1234;" ...) and serve requests until GDB
+    // resumes. A lost connection counts as a detach.
+    Resume stopped(const std::string &reason) {
+        stop_reason = reason;
+        if (!send(reason)) return drop();
+        std::string pkt;
+        for (;;) {
+            if (!receive(pkt)) return drop();
+            Resume r;
+            if (handle(pkt, r)) return r;
+        }
+    }
+
+    // Simulation ended while GDB is attached
+    void exited(int code) {
+        if (fd < 0) return;
+        char buf[8];
+        snprintf(buf, sizeof(buf), "W%02x", code & 0xff);
+        send(buf);
+        close(fd);
+        fd = -1;
+    }
+
+private:
+    // true if the packet resumes the target
+    bool handle(const std::string &pkt, Resume &r) {
+        char cmd = pkt.empty() ? 0 : pkt[0];
+        const char *args = pkt.c_str() + (pkt.empty() ? 0 : 1);
+        switch (cmd) {
+        case '?':
+            send(stop_reason);
+            return false;
+        case 'g': {
+            uint32_t regs[16];
+            target->read_regs(regs);
+            send(hex(regs, sizeof(regs)));
+            return false;
+        }
+        case 'p': {
+            unsigned n = strtoul(args, nullptr, 16);
+            uint32_t regs[16];
+            target->read_regs(regs);
+            send(n < 16 ? hex(&regs[n], 4) : "E00");
+            return false;
+        }
+        case 'm': {
+            char *end;
+            uint32_t addr = strtoul(args, &end, 16);
+            size_t len = std::min<size_t>(strtoul(end + 1, nullptr, 16), MAX_MEM);
+            std::string buf(len, 0);
+            size_t n = target->read_mem(addr, &buf[0], len);
+            send(n ? hex(buf.data(), n) : "E14");
+            return false;
+        }
+        case 'M': {
+            char *end;
+            uint32_t addr = strtoul(args, &end, 16);
+            size_t len = strtoul(end + 1, &end, 16);
+            std::string buf;
+            if (*end != ':' || !unhex(end + 1, len, buf)) {
+                send("E01");
+                return false;
+            }
+            send(target->write_mem(addr, buf.data(), len) == len ? "OK" : "E14");
+            return false;
+        }
+        case 'c':
+        case 's':
+            if (*args) printf("GDB: resuming at an address is not supported, ignored\n");
+            r = cmd == 'c' ? CONTINUE : STEP;
+            return true;
+        case 'b':
+            if (!reverse || (args[0] != 'c' && args[0] != 's')) {
+                send("");
+                return false;
+            }
+            r = args[0] == 'c' ? REVERSE_CONTINUE : REVERSE_STEP;
+            return true;
+        case 'Z':
+        case 'z': {
+            // Z<type>,<addr>,<kind|len>
+            int type = args[0] - '0';
+            char *end;
+            uint32_t addr = strtoul(args + 2, &end, 16);
+            uint32_t len = strtoul(end + 1, nullptr, 16);
+            bool insert = cmd == 'Z';
+            if (type == 0 || type == 1) {
+                if (insert) breakpoints.insert(addr);
+                else breakpoints.erase(addr);
+                send("OK");
+            } else if (type >= 2 && type <= 4)
+                send(target->watch(type, addr, len, insert) ? "OK" : "E01");
+            else
+                send("");
+            return false;
+        }
+        case 'D':
+            send("OK");
+            r = DETACH;
+            close(fd);
+            fd = -1;
+            breakpoints.clear();
+            return true;
+        case 'k':
+            r = KILL;
+            close(fd);
+            fd = -1;
+            return true;
+        case 'H':
+            send("OK");
+            return false;
+        case 'q':
+            if (pkt.compare(0, 10, "qSupported") == 0)
+                send("PacketSize=" + std::to_string(2 * MAX_MEM + 16) + ";swbreak+;hwbreak+" +
+                     (reverse ? ";ReverseContinue+;ReverseStep+" : ""));
+            else if (pkt == "qAttached")
+                send("1");
+            else if (pkt == "qC")
+                send("QC1");
+            else if (pkt == "qfThreadInfo")
+                send("m1");
+            else if (pkt == "qsThreadInfo")
+                send("l");
+            else
+                send("");
+            return false;
+        default:
+            send("");                       // not supported
+            return false;
+        }
+    }
+
+    Resume drop() {
+        printf("GDB connection lost, continuing\n");
+        if (fd >= 0) close(fd);
+        fd = -1;
+        breakpoints.clear();
+        return DETACH;
+    }
+
+    // $<data>#<checksum>, acknowledged with '+'
+    bool send(const std::string &data) {
+        uint8_t sum = 0;
+        for (char c : data) sum += (uint8_t)c;
+        char tail[4];
+        snprintf(tail, sizeof(tail), "#%02x", sum);
+        std::string pkt = "$" + data + tail;
+        for (int tries = 0; tries < 3; tries++) {
+            if (::send(fd, pkt.data(), pkt.size(), 0) != (ssize_t)pkt.size()) return false;
+            uint8_t c;
+            do {
+                if (recv(fd, &c, 1, 0) != 1) return false;
+            } while (c != '+' && c != '-');
+            if (c == '+') return true;
+        }
+        return false;
+    }
+
+    bool receive(std::string &pkt) {
+        uint8_t c;
+        for (;;) {
+            do {
+                if (recv(fd, &c, 1, 0) != 1) return false;
+            } while (c != '$');             // also drops a Ctrl-C while stopped
+            pkt.clear();
+            uint8_t sum = 0;
+            while (recv(fd, &c, 1, 0) == 1 && c != '#') {
+                pkt += (char)c;
+                sum += c;
+            }
+            char cs[3] = {0};
+            if (c != '#' || recv(fd, cs, 2, MSG_WAITALL) != 2) return false;
+            bool ok = strtoul(cs, nullptr, 16) == sum;
+            if (::send(fd, ok ? "+" : "-", 1, 0) != 1) return false;
+            if (ok) return true;
+        }
+    }
+
+    static std::string hex(const void *p, size_t len) {
+        static const char digits[] = "0123456789abcdef";
+        std::string s;
+        for (size_t i = 0; i < len; i++) {
+            uint8_t b = ((const uint8_t *)p)[i];
+            s += digits[b >> 4];
+            s += digits[b & 15];
+        }
+        return s;
+    }
+
+    static bool unhex(const char *s, size_t len, std::string &out) {
+        auto nibble = [](char c) {
+            return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        };
+        if (strlen(s) < 2 * len) return false;
+        out.resize(len);
+        for (size_t i = 0; i < len; i++) {
+            int hi = nibble(s[2 * i]), lo = nibble(s[2 * i + 1]);
+            if (hi < 0 || lo < 0) return false;
+            out[i] = (char)(hi << 4 | lo);
+        }
+        return true;
+    }
+
+    static constexpr size_t MAX_MEM = 4096;    // bytes per m packet
+
+    Target *target = nullptr;
+    int fd = -1;
+    std::string stop_reason = "S05";
+    std::unordered_set<uint32_t> breakpoints;   // linear addresses
+};
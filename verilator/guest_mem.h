@@ -0,0 +1,142 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "guest_mem.h reads sdram.mem as bytes, which needs a little-endian host"
+#endif
+
+// Guest physical memory, i.e. the sdram.mem array of the model. The array is
+// 16-bit words, but on a little-endian host its bytes are laid out exactly like
+// guest memory, so every access is a plain memcpy. Reads past the end return
+// 0xff like an unmapped bus, writes past the end are dropped.
+//
+// The VGA window (0xA0000-0xBFFFF) is not in SDRAM; it lives in vga.v.
+class GuestMem {
+public:
+    void attach(void *base, size_t bytes) {
+        mem = (uint8_t *)base;
+        size = bytes;
+    }
+
+    size_t bytes() const { return size; }
+
+    // direct pointer to [addr, addr+len), nullptr if it does not fit
+    const uint8_t *span(uint32_t addr, size_t len) const {
+        return addr <= size && len <= size - addr ? mem + addr : nullptr;
+    }
+
+    void read(uint32_t addr, void *buf, size_t len) const {
+        size_t n = addr < size ? std::min(len, size - addr) : 0;
+        memcpy(buf, mem + addr, n);
+        memset((uint8_t *)buf + n, 0xff, len - n);
+    }
+
+    void write(uint32_t addr, const void *buf, size_t len) {
+        size_t n = addr < size ? std::min(len, size - addr) : 0;
+        memcpy(mem + addr, buf, n);
+    }
+
+    template <class T> T load(uint32_t addr) const {
+        T v;
+        read(addr, &v, sizeof(v));
+        return v;
+    }
+
+    template <class T> void store(uint32_t addr, T v) { write(addr, &v, sizeof(v)); }
+
+    // NUL-terminated string, at most max bytes
+    std::string string(uint32_t addr, size_t max = 4096) const {
+        if (addr >= size) return std::string();
+        size_t n = std::min(max, size - addr);
+        const void *z = memchr(mem + addr, 0, n);
+        return std::string((const char *)mem + addr, z ? (const uint8_t *)z - (mem + addr) : n);
+    }
+
+    // Linear to physical through the 486 two-level page tables. Returns false
+    // on a not-present entry. Without paging, linear is physical.
+    bool translate(uint32_t lin, uint32_t cr3, bool paging, uint32_t &phys) const {
+        if (!paging) {
+            phys = lin;
+            return true;
+        }
+        uint32_t pde = load<uint32_t>((cr3 & ~0xfffu) + (lin >> 22) * 4);
+        if (!(pde & 1)) return false;
+        uint32_t pte = load<uint32_t>((pde & ~0xfffu) + (lin >> 12 & 0x3ff) * 4);
+        if (!(pte & 1)) return false;
+        phys = (pte & ~0xfffu) | (lin & 0xfff);
+        return true;
+    }
+
+    // Read a linear range page by page. Returns the number of bytes read
+    // before the first unmapped page.
+    size_t read_linear(uint32_t lin, void *buf, size_t len, uint32_t cr3, bool paging) const {
+        size_t done = 0;
+        while (done < len) {
+            uint32_t phys;
+            if (!translate(lin + done, cr3, paging, phys)) break;
+            size_t n = std::min(len - done, (size_t)(0x1000 - ((lin + done) & 0xfff)));
+            read(phys, (uint8_t *)buf + done, n);
+            done += n;
+        }
+        return done;
+    }
+
+    size_t write_linear(uint32_t lin, const void *buf, size_t len, uint32_t cr3, bool paging) {
+        size_t done = 0;
+        while (done < len) {
+            uint32_t phys;
+            if (!translate(lin + done, cr3, paging, phys)) break;
+            size_t n = std::min(len - done, (size_t)(0x1000 - ((lin + done) & 0xfff)));
+            write(phys, (const uint8_t *)buf + done, n);
+            done += n;
+        }
+        return done;
+    }
+
+    // Base address in a protected mode descriptor cache entry
+    static uint32_t seg_base(uint64_t cache) {
+        return (uint32_t)(cache >> 16 & 0xffffff) | (uint32_t)(cache >> 56) << 24;
+    }
+
+    // Write [addr, addr+len) to a file straight from the array
+    bool dump(uint32_t addr, size_t len, const char *fname) const {
+        const uint8_t *p = span(addr, len);
+        if (!p) {
+            printf("Memory range %08x+%zx is outside the %zuMB of memory\n", addr, len, size >> 20);
+            return false;
+        }
+        FILE *f = fopen(fname, "wb");
+        if (!f) {
+            printf("Cannot open %s for writing\n", fname);
+            return false;
+        }
+        bool ok = fwrite(p, 1, len, f) == len;
+        fclose(f);
+        if (!ok) printf("Short write to %s\n", fname);
+        return ok;
+    }
+
+private:
+    uint8_t *mem = nullptr;
+    size_t size = 0;
+};
+
+// "<start>-<end>" (inclusive) or "<start>+<len>" or "<start>", numbers in C
+// syntax. Used by --watch and --dump-mem.
+static inline bool parse_range(const std::string &s, uint32_t &lo, uint32_t &hi) {
+    char *end;
+    lo = strtoul(s.c_str(), &end, 0);
+    if (end == s.c_str()) return false;
+    if (*end == '-') hi = strtoul(end + 1, &end, 0);
+    else if (*end == '+') {
+        uint32_t len = strtoul(end + 1, &end, 0);
+        if (!len) return false;
+        hi = lo + len - 1;
+    } else hi = lo;
+    return *end == 0 && hi >= lo;
+}
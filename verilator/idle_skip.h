@@ -0,0 +1,122 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include "Vsystem_system.h"
+#include "Vsystem_pit.h"
+#include "Vsystem_pit_counter.h"
+#include "Vsystem_rtc.h"
+#include "Vsystem_sound.h"
+#include "Vsystem_sound_dsp.h"
+#include "Vsystem_driver_sd.h"
+#include "vga_timing.h"
+
+// --idle-skip: while the CPU is halted in HLT, the only things that can wake
+// it are interrupts. So instead of evaluating every cycle, the harness jumps
+// to just before the next one and moves the timers there itself:
+// - PIT (pit.v/pit_counter.v): the prescaler, the refresh toggle on port 61h
+//   and the counters. Channel 0 stops a few input clocks before it reloads,
+//   which is when IRQ0 rises. Channel 1 (refresh) wraps as it would.
+// - VGA retrace, which is modelled in C++ with --vga-gate (VgaTiming). The
+//   jump stops before vertical blank, the source of IRQ2 and EV_VSYNC.
+// The cycles right before the event are simulated as usual.
+//
+// Anything else with its own timing makes skip() refuse: the CPU bus or the
+// SD card busy, Sound Blaster DMA, PC speaker gate on, RTC interrupts enabled,
+// or a PIT channel not in a plain mode 2/3 count. The RTC clock does not move
+// during skipped cycles, keyboard and input script timing are the caller's.
+// Skipped cycles have no clk_sys edges, so --perf and --profile do not see
+// them. --cpi and --callgraph measure sim_time and charge them to the HLT.
+class IdleSkip {
+public:
+    // After a clk_sys posedge with the CPU halted and no interrupt pending.
+    // Skips at most max_cycles, returns the cycles skipped. The caller moves
+    // sim_time.
+    uint64_t skip(Vsystem_system &s, VgaTiming &vga, uint64_t max_cycles) {
+        Vsystem_pit &pit = *s.pit;
+        Vsystem_pit_counter *ch[3] = {pit.pit_counter_0, pit.pit_counter_1, pit.pit_counter_2};
+        if (s.avm_read || s.avm_write || s.driver_sd->state != SD_IDLE || s.sound->sound_dsp_inst->dma_in_progress ||
+            s.rtc->crb_int_periodic_ena || s.rtc->crb_int_alarm_ena || s.rtc->crb_int_update_ena || pit.speaker_gate)
+            return 0;
+        if (pit.clk_rate <= SETTLE * PIT_INC || pit.sum < 2 * PIT_INC) return 0;     // prescaler ticked just now
+
+        // input clock pulses each channel can take without reloading
+        uint64_t max_pulses = UINT64_MAX;
+        for (int i = 0; i < 3; i++) {
+            Vsystem_pit_counter &c = *ch[i];
+            if (c.written || c.trigger || c.two_byte_write || c.output_latched || c.status_latched || c.clock_pulse ||
+                c.clock_last != pit.system_clock)
+                return 0;
+            if (!c.loaded) continue;                    // nothing written yet, stays put
+            bool running = i < 2;                       // channel 2 with the gate off holds its count
+            if ((c.mode & 3) < 2 || c.bcd || c.null_counter || c.gate_sampled != running) return 0;
+            if (!running) continue;
+            if (i == 1 && (c.mode & 3) == 2) {          // the refresh counter just wraps
+                if ((c.counter_m << 8 | c.counter_l) == 1) return 0;
+                continue;
+            }
+            max_pulses = std::min(max_pulses, pulses_to_reload(c));
+        }
+        // the prescaler toggles system_clock PIT_INC / clk_rate times per cycle, the
+        // channels count on its falling edges
+        uint64_t rate = pit.clk_rate, n = max_cycles;
+        if (max_pulses != UINT64_MAX) {
+            if (max_pulses < 2) return 0;
+            max_pulses -= 1;                            // land before the last pulse, not on it
+            uint64_t max_ce = pit.system_clock ? 2 * max_pulses : 2 * max_pulses + 1;
+            n = std::min(n, ((max_ce + 1) * rate - 1 - pit.sum) / PIT_INC);
+        }
+        n = vga.quiet_cycles(*s.vga, n);
+        // the last prescaler tick has to be through the pit_counter edge detect
+        while (n && (pit.sum + n * PIT_INC) % rate < SETTLE * PIT_INC) n--;
+        if (n < MIN_CYCLES) return 0;
+
+        uint64_t ce = (pit.sum + n * PIT_INC) / rate;
+        uint64_t pulses = pit.system_clock ? (ce + 1) / 2 : ce / 2;
+        pit.sum = (pit.sum + n * PIT_INC) % rate;
+        pit.system_clock ^= ce & 1;
+        uint64_t refresh = pit.counter_1_cnt + ce;
+        pit.counter_1_cnt = refresh % 36;
+        pit.counter_1_toggle ^= (refresh / 36) & 1;
+        for (int i = 0; i < 3; i++) {
+            Vsystem_pit_counter &c = *ch[i];
+            c.clock_last = pit.system_clock;
+            if (!c.loaded || i == 2) continue;
+            if ((c.mode & 3) == 3)
+                c.counter -= 2 * pulses;
+            else if (i == 1) {
+                // counts R..1, reloading R on the pulse after 1, out low while at 1
+                uint32_t r = c.counter_m << 8 | c.counter_l;
+                if (!r) r = 65536;
+                uint32_t pos = c.counter ? c.counter : 65536;
+                pos = (pos - 1 + r - pulses % r) % r + 1;
+                c.counter = pos;
+                c.out = pos != 1;
+            } else
+                c.counter -= pulses;
+            c.output_l = c.counter & 0xff;
+            c.output_m = c.counter >> 8;
+        }
+        for (uint64_t i = n; i; i--) vga.tick(*s.vga);
+        skips++;
+        cycles += n;
+        return n;
+    }
+
+    uint64_t skips = 0, cycles = 0;
+
+private:
+    static const uint32_t PIT_INC = 2386362;    // pit.v prescaler step, 1193181hz * 2
+    static const int SETTLE = 8;                // cycles since the last prescaler tick
+    static const int MIN_CYCLES = 64;           // not worth it below this
+    static const uint8_t SD_IDLE = 1;           // driver_sd_sim.v
+
+    // pulses until the counter reloads, 0 if it does on the next one
+    static uint64_t pulses_to_reload(const Vsystem_pit_counter &c) {
+        if ((c.mode & 3) == 2) {
+            uint32_t pos = c.counter ? c.counter : 65536;
+            return pos - 1;
+        }
+        uint16_t last = (c.counter_l & 1) && c.out ? 0 : 2;    // mode 3 reloads after this count
+        return (uint16_t)(c.counter - last) / 2;
+    }
+};
@@ -0,0 +1,228 @@
+#pragma once
+#include <SDL.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Keyboard input scripts for --input-script and --record-input. One entry per
+// line, '#' starts a comment:
+//
+//   <when> down <key>       press a key
+//   <when> up <key>         release it
+//   <when> text "<string>"  type a string (\n \t \" \\ escapes), shift as needed
+//
+// <when> is a sim_time ("4500000"), a frame number ("f300", at that VSYNC), or
+// a delay after the previous entry ("+200000"). Keys are named as in
+// key_names below, or given as a decimal SDL_Keycode. Entries fire in order.
+//
+// A live session recorded with --record-input produces only sim_time entries,
+// so replaying it takes exactly the same path as the recording.
+
+struct KeyName { const char *name; SDL_Keycode key; };
+static const KeyName key_names[] = {
+    {"esc", SDLK_ESCAPE}, {"f1", SDLK_F1}, {"f2", SDLK_F2}, {"f3", SDLK_F3}, {"f4", SDLK_F4},
+    {"f5", SDLK_F5}, {"f6", SDLK_F6}, {"f7", SDLK_F7}, {"f8", SDLK_F8}, {"f9", SDLK_F9},
+    {"f10", SDLK_F10}, {"f11", SDLK_F11}, {"f12", SDLK_F12},
+    {"printscreen", SDLK_PRINTSCREEN}, {"scrolllock", SDLK_SCROLLLOCK}, {"pause", SDLK_PAUSE},
+    {"`", SDLK_BACKQUOTE}, {"-", SDLK_MINUS}, {"=", SDLK_EQUALS}, {"backspace", SDLK_BACKSPACE},
+    {"tab", SDLK_TAB}, {"[", SDLK_LEFTBRACKET}, {"]", SDLK_RIGHTBRACKET}, {"\\", SDLK_BACKSLASH},
+    {"capslock", SDLK_CAPSLOCK}, {";", SDLK_SEMICOLON}, {"'", SDLK_QUOTE}, {"enter", SDLK_RETURN},
+    {",", SDLK_COMMA}, {".", SDLK_PERIOD}, {"/", SDLK_SLASH}, {"space", SDLK_SPACE},
+    {"lshift", SDLK_LSHIFT}, {"rshift", SDLK_RSHIFT}, {"lctrl", SDLK_LCTRL}, {"rctrl", SDLK_RCTRL},
+    {"lalt", SDLK_LALT}, {"ralt", SDLK_RALT},
+    {"insert", SDLK_INSERT}, {"home", SDLK_HOME}, {"pageup", SDLK_PAGEUP},
+    {"delete", SDLK_DELETE}, {"end", SDLK_END}, {"pagedown", SDLK_PAGEDOWN},
+    {"up", SDLK_UP}, {"left", SDLK_LEFT}, {"down", SDLK_DOWN}, {"right", SDLK_RIGHT},
+    {"numlock", SDLK_NUMLOCKCLEAR}, {"kp/", SDLK_KP_DIVIDE}, {"kp*", SDLK_KP_MULTIPLY},
+    {"kp-", SDLK_KP_MINUS}, {"kp+", SDLK_KP_PLUS}, {"kp.", SDLK_KP_PERIOD}, {"kpenter", SDLK_KP_ENTER},
+    {"kp0", SDLK_KP_0}, {"kp1", SDLK_KP_1}, {"kp2", SDLK_KP_2}, {"kp3", SDLK_KP_3}, {"kp4", SDLK_KP_4},
+    {"kp5", SDLK_KP_5}, {"kp6", SDLK_KP_6}, {"kp7", SDLK_KP_7}, {"kp8", SDLK_KP_8}, {"kp9", SDLK_KP_9},
+};
+
+// "a".."z", "0".."9", key_names, or a decimal keycode. 0 if unknown.
+static inline SDL_Keycode key_from_name(const std::string &name) {
+    if (name.size() == 1 && (name[0] >= 'a' && name[0] <= 'z' || name[0] >= '0' && name[0] <= '9'))
+        return name[0];
+    for (const KeyName &k : key_names)
+        if (name == k.name) return k.key;
+    char *end;
+    long v = strtol(name.c_str(), &end, 10);
+    return *end == 0 && !name.empty() ? (SDL_Keycode)v : 0;
+}
+
+static inline std::string key_to_name(SDL_Keycode key) {
+    if (key >= 'a' && key <= 'z' || key >= '0' && key <= '9')
+        return std::string(1, (char)key);
+    for (const KeyName &k : key_names)
+        if (key == k.key) return k.name;
+    return std::to_string(key);
+}
+
+class InputScript {
+public:
+    struct Event { bool down; SDL_Keycode key; };
+
+    bool load(const char *fname) {
+        std::ifstream f(fname);
+        if (!f) {
+            printf("Cannot open input script %s\n", fname);
+            return false;
+        }
+        std::string line;
+        int lineno = 0;
+        while (getline(f, line)) {
+            lineno++;
+            size_t hash = line.find('#');
+            if (hash != std::string::npos && line.find('"') > hash) line.resize(hash);
+            std::istringstream iss(line);
+            std::string when, what;
+            if (!(iss >> when)) continue;
+            if (!(iss >> what) || !parse_when(when)) {
+                printf("%s:%d: bad entry: %s\n", fname, lineno, line.c_str());
+                return false;
+            }
+            if (what == "down" || what == "up") {
+                std::string name;
+                iss >> name;
+                SDL_Keycode key = key_from_name(name);
+                if (!key) {
+                    printf("%s:%d: unknown key %s\n", fname, lineno, name.c_str());
+                    return false;
+                }
+                entries.push_back({unit, at, {what == "down", key}});
+            } else if (what == "text") {
+                size_t q0 = line.find('"'), q1 = line.rfind('"');
+                if (q0 == std::string::npos || q1 == q0 || !add_text(line.substr(q0 + 1, q1 - q0 - 1))) {
+                    printf("%s:%d: bad text: %s\n", fname, lineno, line.c_str());
+                    return false;
+                }
+            } else {
+                printf("%s:%d: unknown event %s\n", fname, lineno, what.c_str());
+                return false;
+            }
+        }
+        printf("Loaded %zu key events from %s\n", entries.size(), fname);
+        return true;
+    }
+
+    // Next event that is due, called once per clk_sys cycle. A sim_time entry
+    // fires on the first cycle after that time, as a key queued by poll_sdl()
+    // after the monitors of that step ran would.
+    bool next(uint64_t sim_time, int frame, Event &e) {
+        if (pos >= entries.size()) return false;
+        const Entry &n = entries[pos];
+        uint64_t t = n.at;
+        if (n.unit == DELAY) t += last_fired;
+        if (n.unit == FRAME ? (uint64_t)frame < n.at : sim_time <= t)
+            return false;
+        last_fired = sim_time;
+        e = n.ev;
+        pos++;
+        return true;
+    }
+
+    bool done() const { return pos >= entries.size(); }
+
+    // Position in the script, saved with the harness state so that a snapshot
+    // replay fires the same entries at the same times
+    struct Cursor { uint64_t pos, last_fired; };
+    Cursor cursor() const { return {pos, last_fired}; }
+    void set_cursor(const Cursor &c) {
+        pos = std::min<size_t>(c.pos, entries.size());
+        last_fired = c.last_fired;
+    }
+
+    // sim_time the next entry fires after, UINT64_MAX for none or a frame number
+    uint64_t next_time() const {
+        if (pos >= entries.size() || entries[pos].unit == FRAME) return UINT64_MAX;
+        return entries[pos].at + (entries[pos].unit == DELAY ? last_fired : 0);
+    }
+
+private:
+    enum Unit { TIME, FRAME, DELAY };
+    struct Entry { Unit unit; uint64_t at; Event ev; };
+
+    bool parse_when(const std::string &s) {
+        const char *p = s.c_str();
+        unit = TIME;
+        if (*p == 'f') { unit = FRAME; p++; }
+        else if (*p == '+') { unit = DELAY; p++; }
+        char *end;
+        at = strtoull(p, &end, 0);
+        return end != p && *end == 0;
+    }
+
+    // Expand a string into key presses at the current <when>, then right after each other
+    bool add_text(const std::string &s) {
+        static const char shifted[] = "!@#$%^&*()_+{}|:\"<>?~";
+        static const char base[]    = "1234567890-=[]\\;',./`";
+        bool first = true;
+        for (size_t i = 0; i < s.size(); i++) {
+            char c = s[i];
+            if (c == '\\' && i + 1 < s.size()) {
+                c = s[++i];
+                if (c == 'n') c = '\n';
+                else if (c == 't') c = '\t';
+            }
+            bool shift = false;
+            std::string name;
+            if (c == '\n') name = "enter";
+            else if (c == '\t') name = "tab";
+            else if (c == ' ') name = "space";
+            else if (c >= 'A' && c <= 'Z') { shift = true; name = std::string(1, c - 'A' + 'a'); }
+            else if (const char *p = strchr(shifted, c)) { shift = true; name = std::string(1, base[p - shifted]); }
+            else name = std::string(1, c);
+            SDL_Keycode key = key_from_name(name);
+            if (!key) return false;
+            std::vector<Event> evs;
+            if (shift) evs.push_back({true, SDLK_LSHIFT});
+            evs.push_back({true, key});
+            evs.push_back({false, key});
+            if (shift) evs.push_back({false, SDLK_LSHIFT});
+            for (const Event &ev : evs) {
+                entries.push_back({first ? unit : DELAY, first ? at : 0, ev});
+                first = false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<Entry> entries;
+    size_t pos = 0;
+    uint64_t last_fired = 0;
+    Unit unit = TIME;           // of the line being parsed
+    uint64_t at = 0;
+};
+
+// --record-input: log live key events in the InputScript format
+class InputRecorder {
+public:
+    bool open(const char *fname) {
+        f = fopen(fname, "w");
+        if (!f) {
+            printf("Cannot open %s for writing\n", fname);
+            return false;
+        }
+        fprintf(f, "# ao486 sim keyboard input, replay with --input-script\n");
+        return true;
+    }
+
+    void record(uint64_t sim_time, bool down, SDL_Keycode key) {
+        if (f) fprintf(f, "%llu %s %s\n", (unsigned long long)sim_time, down ? "down" : "up", key_to_name(key).c_str());
+    }
+
+    void close() {
+        if (f) fclose(f);
+        f = nullptr;
+    }
+
+private:
+    FILE *f = nullptr;
+};
@@ -7,13 +7,20 @@
 // nand2mario, 7/2025
 //
 #include "verilated.h"
+#if VM_TRACE                        // Verilator defines it, 0 for the fast build (make fast)
 #include "verilated_fst_c.h"
+#endif
+#if SIM_SAVABLE
+#include "verilated_save.h"
+#endif
 #include "Vsystem.h"
 #include "Vsystem_ao486.h"
 #include "Vsystem_system.h"
 #include "Vsystem__Syms.h"
 #include "Vsystem_pipeline.h"
-#include "Vsystem_driver_sd.h"
+#include "Vsystem_exception.h"
+#include "Vsystem_write.h"
+#include "Vsystem_execute.h"
 #include <svdpi.h>
 #include <fstream>
 #include <iostream>
@@ -21,11 +28,40 @@
 #include <map>
 #include <vector>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <SDL.h>
 #include <chrono>
+#include <thread>
+#include <array>
+#include <utility>
+#include <atomic>
+#include <memory>
+#include <sstream>
 
 #include "ide.h"
 #include "wav_writer.h"
+#include "audio_out.h"
+#include "bench.h"
+#include "monitor.h"
+#include "display.h"
+#include "capture.h"
+#include "input_script.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "perf.h"
+#include "cpi.h"
+#include "idle_skip.h"
+#include "console.h"
+#include "trace_trigger.h"
+#include "event_log.h"
+#include "watch.h"
+#include "guest_mem.h"
+#include "gdb_stub.h"
+#include "rewind.h"
+#include "simulator.h"
 
 using namespace std;
 
@@ -44,7 +80,10 @@ typedef struct Pixel
 	uint8_t r; // red
 } Pixel;
 
-Pixel screenbuffer[H_RES * V_RES];
+// Two frames, the simulation draws into screenbuffer while the main thread
+// may still be showing the other one (see display.h)
+Pixel framebuffers[2][H_RES * V_RES];
+Pixel *screenbuffer = framebuffers[0];
 
 bool trace_toggle = false;
 void set_trace(bool toggle);
@@ -56,18 +95,50 @@ bool trace_symbols = false;
 bool record_audio = false;
 string symbols_file;
 map<uint32_t, string> symbols;
-uint64_t sim_time = 0;
+Simulator sim;                      // the machine, see simulator.h
+uint64_t &sim_time = sim.time;
 uint64_t last_time;
 uint64_t start_time = UINT64_MAX;
 uint64_t stop_time = UINT64_MAX;
-Vsystem tb;
+Vsystem &tb = sim.top();
+#if VM_TRACE
 VerilatedFstC* trace;
+#endif
 int failure = -1;
 uint16_t ignore_mask = 0xf400;      // 15:12 
 int ignore_memory = 0;
-set<uint32_t> watch_memory;         // dword addresses
-bool mem_write_r = 0;
+Watchpoints watchpoints;            // --watch, --mem
+bool watch_snapshot = false;        // a snap watchpoint hit, save state after this step
 uint32_t eip_r = 0;
+string save_state_file;             // --save-state: written when simulation stops
+string load_state_file;             // --load-state: resume instead of booting from reset
+string overlay_file;                // --overlay: copy-on-write file for disk writes
+string trace_file = "waveform.fst";
+TraceTriggers trace_triggers;       // --trace-on, --trace-off: conditions, see trace_trigger.h
+uint64_t trace_for = 0;             // --trace-for: cycles per trace window, 0: until turned off
+uint64_t trace_stop_time = UINT64_MAX;
+string trace_scopes;                // --trace-scope: only trace these instances, see set_trace()
+int profile_interval = 0;           // --profile: sample every N clk_sys cycles, 0: off
+int profile_top = 30;
+string profile_folded;              // --profile-folded: flamegraph input
+string callgraph_file;              // --callgraph: call counts and cycles, see callgraph.h
+bool perf = false;                  // --perf: icache/TLB/prefetch/memory counters, see perf.h
+bool perf_frame = false;            // --perf-frame: also a line per frame
+bool console_on = false;            // --console: text screen rows as they change, see console.h
+string console_file;                // --console-file: the same to a file
+bool idle_skip_on = false;          // --idle-skip: jump over halted cycles, see idle_skip.h
+string event_log_file;              // --event-log: console trace events in binary, see event_log.h
+string cpi_file;                    // --cpi: cycles per instruction by opcode, see cpi.h
+const int PERF_PORT = 0x8889;       // guest OUT: 0 resets the counters, 1 prints them
+int gdb_port = 0;                   // --gdb: RSP server port, 0: off
+bool fast_boot = false;             // --fast-boot: skip the SD boot loader, see Simulator::fast_boot()
+string jobs_file;                   // --jobs: run a batch of machines, see run_jobs()
+string fork_server_file;            // --fork-server: job lines for children of the booted machine
+bool fork_child = false;            // this process is a --fork-server job
+int pool_threads = max(1u, thread::hardware_concurrency());
+string capture_path;                // --capture: frame output, see capture.h
+int capture_every = 1;
+bool capture_changed = false;
 
 // FPS tracking variables (wall clock time)
 uint32_t fps_start_time = 0;
@@ -75,6 +146,29 @@ uint32_t fps_frame_count = 0;
 
 // Headless mode toggle
 bool g_headless = false;
+bool quiet = false;                 // --quiet: no default BIOS print / POST / VSYNC console output
+
+// --bench: per-phase speed report (loader -> bios -> dos, split at CPU release and first PRINT)
+Bench *bench = nullptr;
+string bench_file;
+int bench_stage = 0;                // 0: SD boot loader, 1: BIOS (CPU released), 2: DOS (after first PRINT)
+const char *bench_stages[] = {"loader", "bios", "dos"};
+
+// --flight-recorder: keep the last N..2N clk_sys cycles replayable and write
+// them to an FST only when something goes wrong, see fr_dump()
+uint64_t fr_cycles = 0;             // snapshot interval in clk_sys cycles, 0: off
+string fr_prefix = "flight";        // --fr-out: dumps go to <prefix>_<time>.fst
+int fr_post = -1;                   // --fr-post: trigger on this POST code
+int fr_exc = -1;                    // --fr-exc: trigger on this exception/interrupt vector
+bool fr_replaying = false;          // re-running from a snapshot (flight recorder or rewind)
+const char *fr_reason = nullptr;    // pending trigger
+
+// --rewind: snapshot history every N clk_sys cycles to go back in time, see rewind_to()
+uint64_t rewind_cycles = 0;
+Rewind rewind_history;
+uint64_t rewind_next = UINT64_MAX;  // sim_time of the next rewind snapshot
+uint64_t rewind_target = UINT64_MAX;    // pending WIN-B
+int gdb_reverse = 0;                // pending GDB reverse continue (1) or reverse step (2)
 
 static inline uint32_t get_ticks_ms() {
     if (!g_headless) return SDL_GetTicks();
@@ -86,28 +180,55 @@ static inline uint32_t get_ticks_ms() {
 
 #include "scancode.h"
 
-bool posedge;
+// Main loop specialization flags. The low bits are monitor events with
+// registered handlers, the rest are features the loop checks itself.
+enum {
+    F_POSEDGE  = 1 << 0,        // EV_POSEDGE handlers
+    F_IO       = 1 << 1,        // EV_IO_WRITE / EV_IO_READ handlers
+    F_EIP      = 1 << 2,        // EV_EIP handlers
+    F_VIDEO    = 1 << 3,        // pixel capture and EV_VSYNC handlers
+    F_SDL      = 1 << 4,        // SDL window and event polling
+    F_TRACE    = 1 << 5,        // FST dump on every step
+    F_BENCH    = 1 << 6,        // time eval() for --bench
+    F_ALL      = (1 << 7) - 1
+};
+
+Monitors monitors;
+bool &posedge = sim.posedge;
+bool loop_reconfigure = false;      // main loop has to re-specialize, see sim_loop()
+bool quit_requested = false;        // window closed, or GDB kill
+
+template <unsigned F>
+static inline void step_t() {
+    sim.clock();                                // clk_vga 50Mhz, clk_sys 25Mhz, advances sim_time
+    // eval() returns only after all model threads are done (--threads N), so
+    // public signals peeked between calls are always settled
+    if constexpr (F & F_BENCH) {
+        auto t0 = Bench::clock::now();
+        tb.eval();
+        bench->eval_ns += chrono::duration_cast<chrono::nanoseconds>(Bench::clock::now() - t0).count();
+    } else
+        tb.eval();
+#if VM_TRACE
+    if constexpr (F & F_TRACE) {
+        trace->dump(sim_time);
+    }
+#endif
+}
+
+// Single step outside of the main loop
 void step() {
-    posedge = false;
-    // tb.clk_sys = !tb.clk_sys;
-    // tb.clk_vga = tb.clk_sys;
-    tb.clk_vga = !tb.clk_vga;                   // clk_vga is 50Mhz
-    if (tb.clk_vga) {
-        tb.clk_sys = !tb.clk_sys;               // clk_sys is 25Mhz
-        posedge = tb.clk_sys;
-        tb.clk_audio = tb.clk_sys;              // should be 24.576Mhz, 25Mhz is close enough
-    }
-    tb.eval();
-    sim_time++;
     if (trace_toggle) {
-        trace->dump(sim_time);
+        if (bench) step_t<F_TRACE | F_BENCH>(); else step_t<F_TRACE>();
+    } else {
+        if (bench) step_t<F_BENCH>(); else step_t<0>();
     }
 }
 
-// Simulate a full clk_sys cycle (4 steps)
+// Simulate a full clk_sys cycle (4 steps, 2 with --vga-gate)
 void full_step() {
-    step(); step();
-    step(); step();
+    for (int i = sim.cycle_steps(); i; i--)
+        step();
 }
 
 // Advance time until posedge of clk_sys
@@ -147,7 +268,6 @@ void init_cmos() {
 
 
 bool cpu_io_write_do_r = 0;
-bool cpu_io_read_do_r = 0;
 bool cpu_io_read_done_r = 0;
 uint16_t int10h_ip_r = 0;
 uint8_t crtc_reg = 0;
@@ -156,164 +276,598 @@ bool bios_dbg_active = true;   // for BX_VIRTUAL_PORTS output on port 0x8888
 bool irq5_r = 0;
 bool irq7_r = 0;
 
+// Main loop state (global so that it can be saved with --save-state)
+bool vsync_r = 0;
+int x = 0;
+int y = 0;
+bool speaker_out_r = 0;
+bool speaker_active = false;
+int pix_cnt = 0;
+Fifo<uint8_t, 4096> scancode;       // scancodes waiting to be sent to ps2_device
+uint64_t last_scancode_time;
+InputScript input_script;           // --input-script
+bool input_script_on = false;
+InputRecorder input_recorder;       // --record-input
+
+// Keyboard input since the oldest flight recorder or rewind snapshot, so that
+// a replay sees the same keys at the same time
+struct InputRecord { uint64_t time; vector<uint8_t> codes; };
+vector<InputRecord> fr_input;
+size_t fr_input_pos = 0;
+// --idle-skip jumps over the same span, replayed the same way
+struct SkipRecord { uint64_t time, cycles; };
+vector<SkipRecord> fr_skips;
+size_t fr_skip_pos = 0;
+
+void queue_bytes(const vector<uint8_t> &codes) {
+    for (uint8_t c : codes)
+        if (!scancode.push(c)) {
+            printf("%8lld: Keyboard buffer full, scancode %02x dropped\n", sim_time, c);
+            break;
+        }
+}
+
+// Queue host keyboard input for ps2_device
+void queue_scancodes(const vector<uint8_t> &codes) {
+    queue_bytes(codes);
+    if (fr_cycles || rewind_cycles)
+        fr_input.push_back({sim_time, codes});
+}
+
 // WAV file recording
 static WAVWriter* wav_writer = nullptr;
-static int audio_sample_counter = 0;
+static AudioOut audio_out;                   // --audio
+bool play_audio = false;
+static int audio_sample_counter = 0;         // phase accumulator, see sample_audio()
 static const int AUDIO_SAMPLE_RATE = 48000;
 static const int CLK_AUDIO_FREQ = 25000000;  // 25MHz (close to 24.576MHz)
-static const int SAMPLE_DIVISOR = 512;  // Approximately 48kHz from 25MHz clock
 
+// Console trace output. With --event-log the record goes to the binary log
+// instead and is formatted only when the log is decoded. Replays stay quiet.
+EventLog event_log;
+void emit_event(EventType type, uint16_t port = 0, uint32_t data = 0, uint32_t eip = 0, uint32_t aux = 0,
+                uint8_t flags = 0) {
+    if (fr_replaying) return;
+    EventRecord e = {(uint64_t)sim_time, type, flags, port, data, eip, aux};
+    if (event_log.is_open()) {
+        event_log.add(e);
+        return;
+    }
+    char line[256];
+    format_event(e, line, sizeof(line));
+    fputs(line, stdout);
+}
+
+// EV_IO_WRITE: print IDE I/O writes
 void print_ide_trace() {
-    // print IDE I/O writes and reads
-    if (trace_ide && tb.system->cpu_io_write_do && !cpu_io_write_do_r && 
-        (tb.system->cpu_io_write_address >= 0x1f0 && tb.system->cpu_io_write_address <= 0x1f7 ||
-         tb.system->cpu_io_write_address >= 0x170 && tb.system->cpu_io_write_address <= 0x177)) {
-        printf("%8lld: IDE [%04x]=%02x, EIP=%08x\n", sim_time, tb.system->cpu_io_write_address, tb.system->cpu_io_write_data & 0xff,
-                tb.system->ao486->exe_eip);
-    }
-    // if (trace_ide && tb.system->cpu_io_read_do && !cpu_io_read_do_r && 
-    //     (tb.system->cpu_io_read_address >= 0x1f0 && tb.system->cpu_io_read_address <= 0x1f7 ||
-    //      tb.system->cpu_io_read_address >= 0x170 && tb.system->cpu_io_read_address <= 0x177)) {
-    //     printf("%8lld: IDE read %04x, EIP=%08x\n", sim_time, tb.system->cpu_io_read_address,
-    //             tb.system->ao486->eip);
-    // }
-}
-
-void print_sound_trace() {
-    // print Sound Blaster I/O writes (0x220-0x230 range)
-    if (trace_sound && tb.system->cpu_io_write_do && !cpu_io_write_do_r && 
-        tb.system->cpu_io_write_address >= 0x220 && tb.system->cpu_io_write_address <= 0x230) {
-        const char* port_name = "";
-        switch (tb.system->cpu_io_write_address) {
-            case 0x220: port_name = " (FM Left)"; break;
-            case 0x221: port_name = " (FM Right)"; break;
-            case 0x222: port_name = " (FM Status/Timer)"; break;
-            case 0x223: port_name = " (FM Timer)"; break;
-            case 0x224: port_name = " (Mixer Index)"; break;
-            case 0x225: port_name = " (Mixer Data)"; break;
-            case 0x226: port_name = " (DSP Reset)"; break;
-            case 0x228: port_name = " (FM Status)"; break;
-            case 0x229: port_name = " (FM Register)"; break;
-            case 0x22A: port_name = " (DSP Read Data)"; break;
-            case 0x22C: port_name = " (DSP Write Data/Command)"; break;
-            case 0x22E: port_name = " (DSP Data Available)"; break;
-            case 0x22F: port_name = " (DSP IRQ 16-bit)"; break;
-        }
-        printf("%8lld: SB_WR [%04x]=%02x%s, EIP=%08x\n", sim_time, tb.system->cpu_io_write_address, 
-                tb.system->cpu_io_write_data & 0xff, port_name, tb.system->ao486->exe_eip);
+    if (tb.system->cpu_io_write_address >= 0x1f0 && tb.system->cpu_io_write_address <= 0x1f7 ||
+        tb.system->cpu_io_write_address >= 0x170 && tb.system->cpu_io_write_address <= 0x177) {
+        emit_event(EVT_IDE, tb.system->cpu_io_write_address, tb.system->cpu_io_write_data & 0xff, tb.system->ao486->exe_eip);
     }
+}
+
+// EV_IO_WRITE: print Sound Blaster I/O writes (0x220-0x230 range)
+void print_sound_write() {
+    if (tb.system->cpu_io_write_address >= 0x220 && tb.system->cpu_io_write_address <= 0x230)
+        emit_event(EVT_SB_WRITE, tb.system->cpu_io_write_address, tb.system->cpu_io_write_data & 0xff,
+                   tb.system->ao486->exe_eip);
+}
+
+// EV_IO_READ: print Sound Blaster I/O reads (0x220-0x230 range)
+void print_sound_read() {
+    if (tb.system->cpu_io_read_address >= 0x220 && tb.system->cpu_io_read_address <= 0x230)
+        emit_event(EVT_SB_READ, tb.system->cpu_io_read_address, tb.system->cpu_io_read_data & 0xff,
+                   tb.system->ao486->exe_eip);
+}
+
+// EV_POSEDGE: monitor Sound Blaster IRQ lines (IRQ 5 and IRQ 7)
+void print_sound_irq() {
+    bool irq5 = tb.system->irq_5;
+    bool irq7 = tb.system->irq_7;
     
-    // print Sound Blaster I/O reads (0x220-0x230 range)
-    if (trace_sound && tb.system->cpu_io_read_done && !cpu_io_read_done_r && 
-        tb.system->cpu_io_read_address >= 0x220 && tb.system->cpu_io_read_address <= 0x230) {
-        const char* port_name = "";
-        switch (tb.system->cpu_io_read_address) {
-            case 0x220: port_name = " (FM Left)"; break;
-            case 0x221: port_name = " (FM Right)"; break;
-            case 0x222: port_name = " (FM Status/Timer)"; break;
-            case 0x224: port_name = " (Mixer Index)"; break;
-            case 0x225: port_name = " (Mixer Data)"; break;
-            case 0x228: port_name = " (FM Status)"; break;
-            case 0x22A: port_name = " (DSP Read Data)"; break;
-            case 0x22C: port_name = " (DSP Write Status)"; break;
-            case 0x22E: port_name = " (DSP Data Available)"; break;
-            case 0x22F: port_name = " (DSP IRQ 16-bit)"; break;
-        }
-        printf("%8lld: SB_RD [%04x]=%02x%s, EIP=%08x\n", sim_time, tb.system->cpu_io_read_address, 
-                tb.system->cpu_io_read_data & 0xff, port_name, tb.system->ao486->exe_eip);
+    // Print IRQ 5 state changes
+    if (irq5 != irq5_r) {
+        emit_event(EVT_SB_IRQ, 5, irq5, tb.system->ao486->exe_eip);
+        irq5_r = irq5;
     }
     
-    // Monitor Sound Blaster IRQ lines (IRQ 5 and IRQ 7)
-    if (trace_sound) {
-        bool irq5 = tb.system->irq_5;
-        bool irq7 = tb.system->irq_7;
-        
-        // Print IRQ 5 state changes
-        if (irq5 != irq5_r) {
-            printf("%8lld: SB_IRQ5 %s, EIP=%08x\n", sim_time, irq5 ? "ASSERTED" : "CLEARED", 
-                    tb.system->ao486->exe_eip);
-            irq5_r = irq5;
-        }
-        
-        // Print IRQ 7 state changes
-        if (irq7 != irq7_r) {
-            printf("%8lld: SB_IRQ7 %s, EIP=%08x\n", sim_time, irq7 ? "ASSERTED" : "CLEARED", 
-                    tb.system->ao486->exe_eip);
-            irq7_r = irq7;
-        }
+    // Print IRQ 7 state changes
+    if (irq7 != irq7_r) {
+        emit_event(EVT_SB_IRQ, 7, irq7, tb.system->ao486->exe_eip);
+        irq7_r = irq7;
     }
 }
 
+// EV_IO_WRITE: print video DAC and CRTC register writes
 void print_vga_trace() {
     // print video I/O writes
-    if (trace_vga && tb.system->cpu_io_write_do && !cpu_io_write_do_r && 
-        // tb.system->cpu_io_write_address >= 0x3b0 && tb.system->cpu_io_write_address <= 0x3df) {
-        (tb.system->cpu_io_write_address == 0x3c9 || tb.system->cpu_io_write_address == 0x3c8)) {
-        printf("%8lld: VIDEO [%04x]=%02x, EIP=%08x\n", sim_time, tb.system->cpu_io_write_address, tb.system->cpu_io_write_data & 0xff,
-                tb.system->ao486->exe_eip);
+    // if (tb.system->cpu_io_write_address >= 0x3b0 && tb.system->cpu_io_write_address <= 0x3df) {
+    if (tb.system->cpu_io_write_address == 0x3c9 || tb.system->cpu_io_write_address == 0x3c8) {
+        emit_event(EVT_VIDEO, tb.system->cpu_io_write_address, tb.system->cpu_io_write_data & 0xff, tb.system->ao486->exe_eip);
     }
     // print CRTC reg writes
     uint32_t eax = tb.system->ao486->pipeline_inst->eax;
-    if (trace_vga && tb.system->cpu_io_write_do && !cpu_io_write_do_r && tb.system->cpu_io_write_address == 0x3d4 ) {
+    if (tb.system->cpu_io_write_address == 0x3d4) {
         crtc_reg = tb.system->cpu_io_write_data & 0xff;
         if (tb.system->cpu_io_write_length >= 2) {
-            printf("%8lld: CRTC [%02x]=%02x, EIP=%08x, EAX=%08x\n", sim_time, crtc_reg, (tb.system->cpu_io_write_data >> 8) & 0xff, tb.system->ao486->exe_eip, eax);
+            emit_event(EVT_CRTC, crtc_reg, (tb.system->cpu_io_write_data >> 8) & 0xff, tb.system->ao486->exe_eip, eax);
         }
     }
-    if (trace_vga && tb.system->cpu_io_write_do && !cpu_io_write_do_r && tb.system->cpu_io_write_address == 0x3d5) {
-        printf("%8lld: CRTC [%02x]=%02x, EIP=%08x, EAX=%08x\n", sim_time, crtc_reg, tb.system->cpu_io_write_data & 0xff, 
-                tb.system->ao486->exe_eip, eax);
+    if (tb.system->cpu_io_write_address == 0x3d5) {
+        emit_event(EVT_CRTC, crtc_reg, tb.system->cpu_io_write_data & 0xff, tb.system->ao486->exe_eip, eax);
     }
-
-    // print int 10h calls
-    // if (trace_vga && tb.system->ao486->pipeline_inst->ex_opcode == 0xCD && tb.system->ao486->pipeline_inst->ex_imm == 0x10 &&
-    //     tb.system->ao486->pipeline_inst->ex_valid && tb.system->ao486->pipeline_inst->ex_ready &&
-    //     tb.system->ao486->pipeline_inst->ex_ip_after != int10h_ip_r) {
-    //     int10h_ip_r = tb.system->ao486->pipeline_inst->
-    //     printf("%8lld: INT 10h, EIP=%08x\n", sim_time, tb.system->ao486->eip);
-    // }
-    // if (tb.system->u_z86->ex_ip_after != int10h_ip_r) {
-    //     int10h_ip_r = 0;   // clear int10 IP when CPU moves on to new instruction
-    // }
 }
 
+// EV_EIP: print symbols reached
 void print_symbol_trace() {
-    if (trace_symbols && tb.system->ao486->exe_eip != eip_r) {
-        eip_r = tb.system->ao486->exe_eip;
-        uint32_t cs = tb.system->ao486->pipeline_inst->cs;
-        // EIP points to next instruction, so search for previous 8 bytes for symbol
-        uint32_t addr = cs*16+eip_r;
-        if (symbols.find(addr) != symbols.end()) {
-            printf("%8lld: %-20s CS:IP=%05x SP=%04x\n", sim_time, symbols[addr].c_str(), addr, 
-                    tb.system->ao486->pipeline_inst->esp);
+    uint32_t cs = tb.system->ao486->pipeline_inst->cs;
+    // EIP points to next instruction, so search for previous 8 bytes for symbol
+    uint32_t addr = cs*16+tb.system->ao486->exe_eip;
+    auto it = symbols.find(addr);
+    if (it != symbols.end()) {
+        printf("%8lld: %-20s CS:IP=%05x SP=%04x\n", sim_time, it->second.c_str(), addr, 
+                tb.system->ao486->pipeline_inst->esp);
+    }
+}
+
+// --trace-on/--trace-off: switch tracing when a condition for the other state matches
+void trace_trigger(TraceTriggers::Kind kind, uint32_t a, uint32_t b) {
+    if (fr_replaying) return;
+    if (auto *c = trace_triggers.match(kind, a, b, trace_toggle)) {
+        printf("%8lld: Trace %s: %s\n", sim_time, c->on ? "on" : "off", c->spec.c_str());
+        set_trace(c->on);
+    }
+}
+
+// EV_EIP: eip= conditions
+void trace_trigger_eip() {
+    trace_trigger(TraceTriggers::EIP, tb.system->ao486->exe_eip, tb.system->ao486->pipeline_inst->cs);
+}
+
+// EV_IO_WRITE: io= and post= conditions
+void trace_trigger_io() {
+    trace_trigger(TraceTriggers::IO, tb.system->cpu_io_write_address, tb.system->cpu_io_write_data & 0xff);
+}
+
+// EV_VSYNC: frame= conditions, frame_count is the frame that just ended
+void trace_trigger_frame() {
+    trace_trigger(TraceTriggers::FRAME, frame_count, 0);
+}
+
+// The first hit of a watchpoint starts tracing or asks for a snapshot. Every
+// hit is a watch condition for --trace-on/--trace-off.
+void watch_hit(const Watchpoints::Watch *w) {
+    trace_trigger(TraceTriggers::WATCH, 0, 0);
+    if (w->hits != 1 || fr_replaying) return;
+    if (w->action == Watchpoints::TRACE && !trace_toggle)
+        set_trace(true);
+    if (w->action == Watchpoints::SNAPSHOT) {
+        watch_snapshot = true;
+        loop_reconfigure = true;
+    }
+}
+
+// EV_POSEDGE: watch memory ranges, on each accepted Avalon request. A read
+// burst covers burstcount dwords, byte enables apply to the first one.
+void watch_memory_trace() {
+    auto *s = tb.system;
+    if (s->avm_waitrequest) return;
+    if (s->avm_write) {
+        if (auto *w = watchpoints.check(s->avm_address, s->avm_byteenable, Watchpoints::WRITE)) {
+            printf("%8lld: WRITE [%08x]=%08x, BE=%1x, EIP=%08x\n", sim_time, s->avm_address << 2, s->avm_writedata,
+                    s->avm_byteenable, s->ao486->exe_eip);
+            watch_hit(w);
+        }
+    } else if (s->avm_read) {
+        for (int i = 0; i < s->avm_burstcount; i++)
+            if (auto *w = watchpoints.check(s->avm_address + i, i ? 0xf : s->avm_byteenable, Watchpoints::READ)) {
+                printf("%8lld: READ [%08x], BE=%1x, burst=%d, EIP=%08x\n", sim_time, s->avm_address << 2,
+                        s->avm_byteenable, s->avm_burstcount, s->ao486->exe_eip);
+                watch_hit(w);
+                break;
+            }
+    }
+}
+
+// EV_IO_WRITE: Bochs BIOS debug (BX_VIRTUAL_PORTS) on port 0x8888 and POST codes on 0x190
+void print_bios_debug() {
+    if (tb.system->cpu_io_write_address == 0x8888)
+        emit_event(EVT_BIOS_DEBUG, 0x8888, tb.system->cpu_io_write_data & 0xFF);    // yellow
+    if (tb.system->cpu_io_write_address == 0x190)
+        emit_event(EVT_POST, 0x190, tb.system->cpu_io_write_data & 0xFF);           // purple
+}
+
+// EV_EIP: BIOS interrupt service taps
+void print_bios_calls() {
+    uint32_t eip = tb.system->ao486->exe_eip;
+    uint16_t cs = tb.system->ao486->pipeline_inst->cs;
+    // Trace int 10h (Eh) to print character
+    if (eip == 0xA58 && cs == 0xC000) {
+        uint32_t eax = tb.system->ao486->pipeline_inst->eax;
+        if ((eax >> 8 & 0xFF) == 0xE) {
+            emit_event(EVT_PRINT, 0, eax & 0xFF, eip, 0, sim_time - last_time > 1e5);    // new PRINT: line after a pause
+            last_time = sim_time;
+        }
+    }
+    // Trace int 13h disk accesses
+    if (eip == 0x85d3 && cs == 0xF000) {
+        uint32_t eax = tb.system->ao486->pipeline_inst->eax;
+        uint32_t ecx = tb.system->ao486->pipeline_inst->ecx;
+        uint32_t edx = tb.system->ao486->pipeline_inst->edx;
+        emit_event(EVT_INT13, 0, (eax & 0xFFFF) | (ecx & 0xFFFF) << 16, eip, edx & 0xFFFF);     // C/H/S decoded by format_event()
+    }
+    // Trace int 15h memory size detection
+    if (eip == 0xf85c && cs == 0xF000) {
+        uint32_t eax = tb.system->ao486->pipeline_inst->eax;
+        uint32_t ecx = tb.system->ao486->pipeline_inst->ecx;
+        uint32_t edx = tb.system->ao486->pipeline_inst->edx;
+        emit_event(EVT_INT15, 0, (eax & 0xFFFF) | (ecx & 0xFFFF) << 16, eip, edx & 0xFFFF);
+    }
+}
+
+// EV_POSEDGE: sample the DSP + OPL3 mix at exactly AUDIO_SAMPLE_RATE. The
+// accumulator takes a sample on 48000 out of every 25000000 clk_audio cycles.
+void sample_audio() {
+    if (fr_replaying) return;       // samples were already written the first time
+    audio_sample_counter += AUDIO_SAMPLE_RATE;
+    if (audio_sample_counter >= CLK_AUDIO_FREQ) {
+        audio_sample_counter -= CLK_AUDIO_FREQ;
+
+        // mixed and clamped like ao486_top.v does on the board
+        int l = (int16_t)tb.sample_sb_l + (int16_t)tb.sample_opl_l;
+        int r = (int16_t)tb.sample_sb_r + (int16_t)tb.sample_opl_r;
+        int16_t sample_l = (int16_t)max(-32768, min(32767, l));
+        int16_t sample_r = (int16_t)max(-32768, min(32767, r));
+        
+        if (wav_writer) {
+            wav_writer->writeSample(sample_l, sample_r);
+        }
+        if (play_audio) {
+            audio_out.push(sample_l, sample_r);
+        }
+    }
+}
+
+// EV_POSEDGE: --profile
+Profiler profiler;
+int profile_count = 0;
+void profile_sample() {
+    if (++profile_count < profile_interval || fr_replaying) return;
+    profile_count = 0;
+    profiler.sample(tb.system->ao486->pipeline_inst->cs * 16 + tb.system->ao486->exe_eip);
+}
+
+// EV_POSEDGE: --callgraph. Commands are counted at the write stage, on the
+// micro-op that starts them (see autogen/defines.v for the cmdex steps).
+CallGraph callgraph;
+void callgraph_trace() {
+    if (fr_replaying) return;
+    auto *ao = tb.system->ao486;
+    auto *pipe = ao->pipeline_inst;
+    auto *wr = pipe->write_inst;
+    uint32_t eip = ao->exe_eip;
+    uint64_t cycle = sim_time / 4;
+    // the callee is the first instruction executed after the transfer
+    bool event = ao->exc_load || wr->wr_ready && (wr->wr_cmd == CMD_CALL || wr->wr_cmd == CMD_RET_near ||
+                                                 wr->wr_cmd == CMD_RET_far || wr->wr_cmd == CMD_IRET);
+    if (callgraph.is_pending() && (eip != callgraph.pending_from() || event))
+        callgraph.resolve(pipe->cs * 16 + eip, pipe->cpl, cycle);
+    if (ao->exc_load)                   // INT n, IRQ or exception
+        callgraph.enter(CallGraph::INT, eip);
+    if (!wr->wr_ready) return;
+    switch (wr->wr_cmd) {
+    case CMD_CALL:
+        if (wr->wr_cmdex <= 3) callgraph.enter(CallGraph::CALL, eip);      // Ev, Jv, Ep, Ap STEP_0
+        break;
+    case CMD_RET_near:
+        if (wr->wr_cmdex == 2) callgraph.ret(pipe->cpl, cycle);           // LAST
+        break;
+    case CMD_RET_far:
+        if (wr->wr_cmdex == 1) callgraph.ret(pipe->cpl, cycle);           // STEP_1
+        break;
+    case CMD_IRET:
+        if (wr->wr_cmdex == 0 || wr->wr_cmdex == 4) callgraph.iret(pipe->cpl, cycle);   // real / protected STEP_0
+        break;
+    }
+}
+
+// EV_POSEDGE / EV_IO_WRITE / EV_VSYNC: --perf
+PerfCounters perf_counters;
+void perf_sample() {
+    if (!fr_replaying) perf_counters.sample(*tb.system);
+}
+
+void perf_port() {
+    if (tb.system->cpu_io_write_address != PERF_PORT || fr_replaying) return;
+    if ((tb.system->cpu_io_write_data & 0xFF) == 0) {
+        printf("%8lld: PERF: counters reset by guest\n", sim_time);
+        perf_counters.reset();
+    } else {
+        printf("%8lld: PERF: report requested by guest\n", sim_time);
+        perf_counters.report(stdout);
+    }
+}
+
+void perf_frame_line() {
+    if (!fr_replaying) perf_counters.frame_line(stdout, sim_time);
+}
+
+// EV_POSEDGE: --cpi. The write stage has no copy of the 0F prefix flag, so
+// it is taken from the execute stage when the instruction moves on (w_load).
+CpiProfile cpi;
+bool cpi_w_load_r, cpi_2byte_r, cpi_2byte;
+void cpi_trace() {
+    if (fr_replaying) return;
+    auto *pipe = tb.system->ao486->pipeline_inst;
+    auto *wr = pipe->write_inst;
+    if (cpi_w_load_r) cpi_2byte = cpi_2byte_r;
+    cpi_w_load_r = wr->w_load;
+    cpi_2byte_r = pipe->execute_inst->exe_prefix_2byte;
+    if (wr->wr_finished && !wr->wr_string_in_progress)
+        cpi.retire(CpiProfile::classify(cpi_2byte, wr->wr_decoder, wr->wr_prefix_group_1_rep, wr->wr_prefix_group_1_lock,
+                                        wr->wr_operand_32bit, wr->wr_address_32bit), sim_time / 4);
+}
+
+// EV_POSEDGE: send scancode to ps2_device and answer keyboard commands
+void keyboard_service() {
+    // flight recorder replay: keys arrive from the log instead of SDL. They were
+    // queued after the monitors of their step ran, so they show up one step later.
+    while (fr_replaying && fr_input_pos < fr_input.size() && fr_input[fr_input_pos].time < sim_time)
+        queue_bytes(fr_input[fr_input_pos++].codes);
+
+    // --input-script. Not logged in fr_input: its cursor is part of the
+    // snapshots, so replays and rewinds run the script again from there.
+    InputScript::Event ev;
+    while (input_script_on && input_script.next(sim_time, frame_count, ev)) {
+        auto it = ps2scancodes.find(ev.key);
+        if (it != ps2scancodes.end())
+            queue_bytes(ev.down ? it->second.first : it->second.second);
+    }
+
+    // one scancode takes about 1ms (we'll wait 2ms)
+    if (sim_time - last_scancode_time > 1e5  && !scancode.empty()) {
+        emit_event(EVT_KBD_SEND, 0, scancode.front());
+        last_scancode_time = sim_time;
+        tb.kbd_data = scancode.front();
+        tb.kbd_data_valid = 1;
+        scancode.pop();
+    } else {
+        tb.kbd_data_valid = 0;
+    }
+
+    if (tb.kbd_host_data & 0x100) {
+        uint8_t cmd = tb.kbd_host_data & 0xff;
+        emit_event(EVT_KBD_COMMAND, 0, cmd);
+        tb.kbd_host_data_clear = 1;
+        if (cmd == 0xFF) {
+            emit_event(EVT_KBD_RESET);
+            queue_bytes({0xFA, 0xAA});
+            last_scancode_time = sim_time;    // 0xFA is sent 1ms later
+        } else if (cmd >= 0xF0) {
+            // respond to all commands with an ACK
+            queue_bytes({0xFA});
+            last_scancode_time = sim_time;    // 0xFA is sent 1ms later
         }
+    } else if (tb.kbd_host_data_clear) {
+        tb.kbd_host_data_clear = 0;
+    }
+}
+
+// EV_POSEDGE: --idle-skip, jump while halted unless the harness has something due
+IdleSkip idle_skip;
+uint64_t loop_until;                // `until` of the running sim_loop()
+void idle_skip_check() {
+    Vsystem_system *s = tb.system;
+    if (!s->ao486->pipeline_inst->write_inst->wr_hlt_in_progress || s->interrupt_do) return;
+    if (!scancode.empty() || tb.kbd_data_valid || tb.kbd_host_data & 0x100) return;    // keyboard_service() is busy
+    uint64_t until = min(loop_until, input_script_on ? input_script.next_time() : UINT64_MAX);
+    const uint64_t t = Simulator::CYCLE_TIME;
+    if (until <= sim_time || (until - sim_time) / t < 2) return;
+    uint64_t max_cycles = (until - sim_time) / t - 1;
+    if (fr_replaying) {
+        // loop_until is the replay target here, so take the recorded jumps
+        // instead. The same state and limit give the same jump.
+        while (fr_skip_pos < fr_skips.size() && fr_skips[fr_skip_pos].time < sim_time) fr_skip_pos++;
+        if (fr_skip_pos == fr_skips.size() || fr_skips[fr_skip_pos].time != sim_time ||
+            fr_skips[fr_skip_pos].cycles > max_cycles)
+            return;
+        max_cycles = fr_skips[fr_skip_pos++].cycles;
+    }
+    uint64_t n = idle_skip.skip(*s, sim.vga_timing, max_cycles);
+    if (n && !fr_replaying && (fr_cycles || rewind_cycles))
+        fr_skips.push_back({sim_time, n});
+    sim_time += n * t;
+}
+
+// EV_POSEDGE / EV_EIP: --bench phase changes at CPU release and at the first INT 10h print
+void bench_boot_done() {
+    if (bench_stage == 0 && tb.system->boot_done) {
+        bench_stage = 1;
+        bench->begin(bench_stages[bench_stage], sim_time);
+    }
+}
+
+void bench_first_print() {
+    if (bench_stage == 1 && tb.system->ao486->exe_eip == 0xA58 && tb.system->ao486->pipeline_inst->cs == 0xC000 &&
+        (tb.system->ao486->pipeline_inst->eax >> 8 & 0xFF) == 0xE) {
+        bench_stage = 2;
+        bench->begin(bench_stages[bench_stage], sim_time);
+    }
+}
+
+// EV_VSYNC: --capture, screenbuffer holds the finished frame
+FrameCapture capture;
+// EV_VSYNC: --console
+TextConsole text_console;
+void console_frame() {
+    if (!fr_replaying) text_console.frame(*tb.system->vga, sim_time);
+}
+
+void capture_frame() {
+    if (!fr_replaying)
+        capture.frame((const uint32_t *)screenbuffer, H_RES, min(resolution_x, H_RES), min(resolution_y, V_RES), frame_count);
+}
+
+// EV_VSYNC: frame log line
+void print_vsync() {
+    emit_event(EVT_VSYNC, tb.system->ao486->pipeline_inst->cs, pix_cnt, tb.system->ao486->exe_eip,
+               (x_cnt & 0xffff) | y_cnt << 16, speaker_active);
+}
+
+// Ask the main loop to dump the flight recorder once the current step is done
+void fr_trigger(const char *reason) {
+    if (!fr_cycles || fr_replaying || fr_reason) return;
+    fr_reason = reason;
+    loop_reconfigure = true;
+}
+
+// EV_IO_WRITE: --fr-post
+void fr_check_post() {
+    if (tb.system->cpu_io_write_address == 0x190 && (tb.system->cpu_io_write_data & 0xFF) == fr_post)
+        fr_trigger("POST code");
+}
+
+// EV_POSEDGE: --fr-exc, and CPU shutdown (triple fault) which sets failure.
+// exc_load is a one-cycle pulse, so each exception is seen once.
+bool shutdown_r = 0;
+void fr_check_cpu() {
+    if (fr_exc >= 0 && tb.system->ao486->exc_load && tb.system->ao486->exc_vector == fr_exc)
+        fr_trigger("exception");
+    bool shutdown = tb.system->ao486->exception_inst->shutdown;
+    if (shutdown && !shutdown_r && failure < 0) {
+        printf("%8lld: CPU shutdown, EIP=%08x\n", sim_time, tb.system->ao486->exe_eip);
+        failure = 1;
+        loop_reconfigure = true;
     }
+    shutdown_r = shutdown;
 }
 
-uint8_t read_byte(uint32_t addr) {
-    // Access SDRAM model array (flattened) inside Vsystem_system
-    uint16_t w = tb.system->sdram__DOT__mem[addr >> 1];
-    return (w >> (8 * (addr & 1))) & 0xff;
+// Guest memory, see guest_mem.h. Physical addresses go to guest_mem directly,
+// guest_linear() and guest_read() add segmentation and paging with the
+// current CPU state.
+GuestMem &guest_mem = sim.mem;
+enum Seg { SEG_ES, SEG_CS, SEG_SS, SEG_DS, SEG_FS, SEG_GS };
+
+uint32_t guest_linear(Seg seg, uint32_t off) {
+    auto *p = tb.system->ao486->pipeline_inst;
+    static const int n = 6;
+    const uint16_t sel[n] = {p->es, p->cs, p->ss, p->ds, p->fs, p->gs};
+    const uint64_t cache[n] = {p->es_cache, p->cs_cache, p->ss_cache, p->ds_cache, p->fs_cache, p->gs_cache};
+    if (!p->cr0_pe || p->v8086_mode)
+        return sel[seg] * 16 + off;
+    return GuestMem::seg_base(cache[seg]) + off;
 }
 
-uint16_t read_word(uint32_t addr) {
-    return  read_byte(addr) + 
-            ((uint16_t)read_byte(addr+1) << 8);
+// bytes read before the first unmapped page
+size_t guest_read(uint32_t lin, void *buf, size_t len) {
+    auto *p = tb.system->ao486->pipeline_inst;
+    return guest_mem.read_linear(lin, buf, len, p->cr3, p->cr0_pg);
 }
 
-uint32_t read_dword(uint32_t addr) {
-    return  read_byte(addr) + 
-            ((uint32_t)read_byte(addr+1) << 8) + 
-            ((uint32_t)read_byte(addr+2) << 16) + 
-            ((uint32_t)read_byte(addr+3) << 24);
+size_t guest_write(uint32_t lin, const void *buf, size_t len) {
+    auto *p = tb.system->ao486->pipeline_inst;
+    return guest_mem.write_linear(lin, buf, len, p->cr3, p->cr0_pg);
 }
 
-string read_string(uint32_t addr) {
-    string r;
-    for (;;) {
-        char c = read_byte(addr++);
-        if (!c) return r;
-        r += c;
+// --dump-mem: physical ranges written when the simulation stops
+struct MemDump { uint32_t lo, hi; string file; };
+vector<MemDump> mem_dumps;
+
+// --gdb: registers come from pipeline_inst, memory is linear (paged like the
+// CPU sees it). Watchpoints are checked on the Avalon bus like --watch, so
+// they are only accepted with paging off, where linear is physical. A mapping
+// taken at insert time would go stale at the next CR3 load. Stop replies
+// report the address GDB inserted.
+Watchpoints gdb_watch;
+struct SimGdbTarget : GdbStub::Target {
+    void read_regs(uint32_t r[16]) override {
+        auto *p = tb.system->ao486->pipeline_inst;
+        uint32_t flags = p->cflag | 2 | p->pflag << 2 | p->aflag << 4 | p->zflag << 6 | p->sflag << 7 |
+                         p->tflag << 8 | p->iflag << 9 | p->dflag << 10 | p->oflag << 11 | p->iopl << 12 |
+                         p->ntflag << 14 | p->rflag << 16 | p->vmflag << 17 | p->acflag << 18 | p->idflag << 21;
+        const uint32_t v[16] = {p->eax, p->ecx, p->edx, p->ebx, p->esp, p->ebp, p->esi, p->edi,
+                                p->eip, flags, p->cs, p->ss, p->ds, p->es, p->fs, p->gs};
+        memcpy(r, v, sizeof(v));
+    }
+    size_t read_mem(uint32_t addr, void *buf, size_t len) override { return guest_read(addr, buf, len); }
+    size_t write_mem(uint32_t addr, const void *buf, size_t len) override { return guest_write(addr, buf, len); }
+    bool watch(int type, uint32_t addr, uint32_t len, bool insert) override {
+        if (!len) return false;
+        uint8_t mode = type == 2 ? Watchpoints::WRITE : type == 3 ? Watchpoints::READ : Watchpoints::READ | Watchpoints::WRITE;
+        if (!insert) return gdb_watch.remove(addr, addr + len - 1, mode);
+        if (tb.system->ao486->pipeline_inst->cr0_pg) {
+            printf("%8lld: GDB watchpoint at %08x refused, paging is on\n", sim_time, addr);
+            return false;               // E01
+        }
+        Watchpoints::Watch w = {addr, addr + len - 1, mode, 0xf, Watchpoints::LOG};
+        w.addr = addr;
+        bool ok = gdb_watch.add(w);
+        if (ok) loop_reconfigure = true;
+        return ok;
+    }
+};
+SimGdbTarget gdb_target;
+GdbStub gdb;
+bool gdb_step = false;
+uint32_t gdb_eip_r = 0;
+string gdb_stop;                    // pending stop reply, sent at the next instruction boundary
+int gdb_poll = 0;
+// reverse execution replays a window and records its last stop instead, see gdb_reverse_run()
+int gdb_scan = 0;                   // 1: breakpoints and watchpoints, 2: every instruction
+uint64_t gdb_scan_limit = 0, gdb_scan_hit = UINT64_MAX;
+string gdb_scan_reason;
+
+void gdb_stopped(const string &reason) {
+    printf("%8lld: GDB stop %s at %04x:%08x\n", sim_time, reason.c_str(),
+           tb.system->ao486->pipeline_inst->cs, tb.system->ao486->pipeline_inst->eip);
+    switch (gdb.stopped(reason)) {
+    case GdbStub::CONTINUE: gdb_step = false; break;
+    case GdbStub::STEP: gdb_step = true; break;
+    case GdbStub::REVERSE_CONTINUE: gdb_step = false; gdb_reverse = 1; loop_reconfigure = true; break;
+    case GdbStub::REVERSE_STEP: gdb_step = false; gdb_reverse = 2; loop_reconfigure = true; break;
+    case GdbStub::DETACH: gdb_step = false; break;
+    case GdbStub::KILL: quit_requested = true; loop_reconfigure = true; break;
+    }
+}
+
+// EV_POSEDGE: --gdb. The architectural eip changes when an instruction
+// retires; everything older has been written back and nothing younger has,
+// so that is where the simulation stops.
+void gdb_check() {
+    if (!gdb.connected() || fr_replaying && !gdb_scan) return;
+    auto *s = tb.system;
+    if (!gdb_watch.empty() && !s->avm_waitrequest && (s->avm_write || s->avm_read) && gdb_stop.empty()) {
+        Watchpoints::Watch *w = nullptr;
+        if (s->avm_write)
+            w = gdb_watch.check(s->avm_address, s->avm_byteenable, Watchpoints::WRITE);
+        else
+            for (int i = 0; i < s->avm_burstcount && !w; i++)
+                w = gdb_watch.check(s->avm_address + i, i ? 0xf : s->avm_byteenable, Watchpoints::READ);
+        if (w) {
+            char buf[48];
+            snprintf(buf, sizeof(buf), "T05%s:%x;", w->mode == Watchpoints::WRITE ? "watch" :
+                     w->mode == Watchpoints::READ ? "rwatch" : "awatch", w->addr);
+            gdb_stop = buf;
+        }
+    }
+    if (!fr_replaying && ++gdb_poll >= 65536) {
+        gdb_poll = 0;
+        if (gdb.interrupted() && gdb_stop.empty()) gdb_stop = "T02";
+    }
+    uint32_t eip = s->ao486->pipeline_inst->eip;
+    if (eip == gdb_eip_r) return;
+    gdb_eip_r = eip;
+    if (gdb_stop.empty() && (gdb_step || gdb_scan == 2 || gdb.breakpoint(guest_linear(SEG_CS, eip))))
+        gdb_stop = "T05";
+    if (!gdb_stop.empty()) {
+        string reason;
+        reason.swap(gdb_stop);
+        if (!fr_replaying)
+            gdb_stopped(reason);
+        else if (sim_time < gdb_scan_limit) {
+            gdb_scan_hit = sim_time;
+            gdb_scan_reason = reason;
+        }
     }
 }
 
@@ -351,13 +905,13 @@ void bios_printf(const string fmt, uint32_t sp, uint32_t ds, uint32_t ss) {
                 switch (type) {
                     case 's':
                     case 'S':
-                        arg = read_word(ss*16+sp);
+                        arg = guest_mem.load<uint16_t>(ss*16+sp);
                         sp+=2;
-                        str = read_string(ds*16+arg);
+                        str = guest_mem.string(ds*16+arg);
                         printf("%s", str.c_str());
                         break;
                     case 'c':
-                        c = read_byte(ss*16+sp);
+                        c = guest_mem.load<uint8_t>(ss*16+sp);
                         sp++;
                         printf("%c", c);
                         break;
@@ -366,7 +920,7 @@ void bios_printf(const string fmt, uint32_t sp, uint32_t ds, uint32_t ss) {
                     case 'u':
                     case 'd':
                     {
-                        argu = read_word(ss*16+sp);
+                        argu = guest_mem.load<uint16_t>(ss*16+sp);
                         sp+=2;
                         // For 'd', cast to int for signed printing
                         if (type == 'd')
@@ -394,14 +948,59 @@ void usage() {
     printf("  -s T0     start tracing at time T0\n");
     printf("  -e T1     stop simulation at time T1\n");
     printf("  --trace   start trace immediately\n");
+    printf("  --trace-on <cond>  start tracing when cond matches: eip=[<cs>:]<eip>, io=<port>[:<value>], post=<code>, watch\n");
+    printf("                     (a --watch hit) or frame=<n>, numbers hex except n; repeat for more\n");
+    printf("  --trace-off <cond> stop tracing when cond matches, same conditions\n");
+    printf("  --trace-for <N>    stop each trace window after N clk_sys cycles\n");
+    printf("  --trace-scope <path>[:<depth>],...  only trace these instances under TOP.system (e.g. ao486.pipeline_inst:2)\n");
     printf("  --vga     print VGA related operations\n");
     printf("  --ide     print ATA/IDE related operations\n");
     printf("  --sound   print Sound Blaster related operations\n");
-    printf("  --record  record DSP audio output to dsp.wav\n");
+    printf("  --record  record DSP and OPL3 audio output to dsp.wav\n");
+    printf("  --audio   play DSP and OPL3 audio output on the host\n");
     printf("  --post    print POST codes\n");
-    printf("  --mem <addr> watch memory location\n");
+    printf("  --mem <addr> watch writes to a memory dword\n");
+    printf("  --watch <start>[-<end>|+<len>][,r|w|rw][,be=<mask>][,trace|,snap] watch a memory range, see watch.h\n");
     printf("  --symbols <file> print symbols reached by EIP\n");
+    printf("  --dump-mem <start>[-<end>|+<len>],<file> write physical memory to a file when simulation stops\n");
     printf("  --headless        run without creating an SDL window\n");
+    printf("  --vga-gate        with --headless, stop the VGA pixel clock and only model retrace timing (about 2x faster)\n");
+    printf("  --console         print text mode screen rows when they change, once per frame (with --vga-gate: no pixel work)\n");
+    printf("  --console-file <file> the same, to a file\n");
+    printf("  --idle-skip       with --vga-gate, jump to the next timer or retrace interrupt while the CPU is in HLT\n");
+    printf("  --overlay <file>  persist disk writes (WIN-S) to a copy-on-write overlay instead of the image\n");
+    printf("  --quiet           no BIOS debug, POST, INT 10h/13h/15h and VSYNC console output\n");
+    printf("  --bench <file>    write per-phase speed, eval() share and process peak RSS as JSON (implies --headless)\n");
+    printf("  --save-state <file> save a snapshot of the whole system when simulation stops (or on WIN-P)\n");
+    printf("  --load-state <file> resume from a snapshot instead of booting from reset\n");
+    printf("  --input-script <file> type keys from a script, see input_script.h\n");
+    printf("  --record-input <file>  record keys typed in the window in --input-script format\n");
+    printf("  --profile <N>     sample CS:EIP every N cycles, print the top symbols at exit (names from --symbols)\n");
+    printf("  --profile-top <N> number of symbols in the report (default 30)\n");
+    printf("  --profile-folded <file> also write folded stacks for flamegraph.pl\n");
+    printf("  --callgraph <file> count calls and cycles per function, summarize with callgraph.py\n");
+    printf("  --disk-latency <N>[,<M>] SD card waits N cycles per command plus M per sector before the data (default 0)\n");
+    printf("  --event-log <file> write trace events (VSYNC, keyboard, IDE/SB/CRTC, PRINT) to a binary log, decode with ./eventlog\n");
+    printf("  --cpi <file>      write cycles per instruction by opcode class, compare runs with cpi_diff.py\n");
+    printf("  --perf            count icache, TLB, prefetch and memory latency events, print them at exit\n");
+    printf("                    (guest OUT 0x8889: 0 resets, 1 prints)\n");
+    printf("  --perf-frame      --perf plus one line per frame\n");
+    printf("  --fast-boot       copy the BIOSes into SDRAM and apply the config sectors directly, skipping the SD boot loader\n");
+    printf("  --jobs <file>     run the jobs in file, one \"<image> <stop_time> [fast-boot] [vga-gate]\" per line, headless in one process\n");
+    printf("  --pool-threads <N> machines running at once for --jobs and --fork-server (default: number of CPUs)\n");
+    printf("  --fork-server <file> after running to -e, fork a copy of the machine for each job line in file (- for stdin, or a FIFO)\n");
+    printf("                    job: <name> <stop_time>|+<cycles> [input=<script>] [log=<file>] [event-log=<file>] [save-state=<file>]\n");
+    printf("  --gdb <port>      wait for GDB on localhost:<port> and stop at its breakpoints and watchpoints\n");
+    printf("  --capture <dir|file.y4m> save frames at VSYNC as PNG files in dir, or as a Y4M stream\n");
+    printf("  --capture-every <N> only capture every Nth frame\n");
+    printf("  --capture-changed   only capture frames that differ from the last captured one\n");
+    printf("  --flight-recorder <N> keep the last N..2N clk_sys cycles and write them to an FST on a trigger:\n");
+    printf("                    WIN-F, --fr-post, --fr-exc or CPU shutdown (which also stops the simulation)\n");
+    printf("  --fr-post <code>  flight recorder trigger on a POST code (hex)\n");
+    printf("  --fr-exc <vector> flight recorder trigger on an exception or interrupt vector\n");
+    printf("  --fr-out <prefix> flight recorder output, <prefix>_<time>.fst (default flight)\n");
+    printf("  --rewind <N>      keep a snapshot every N clk_sys cycles to go back in time: WIN-B, GDB reverse-continue/stepi\n");
+    printf("  --rewind-depth <K> number of rewind snapshots kept (default 64)\n");
     printf("\nSD card image layout:\n");
     printf("  offset 0:     boot0.rom (BIOS, 64KB)\n");
     printf("  offset 64KB:  boot1.rom (VGA BIOS, 32KB)\n");
@@ -409,7 +1008,11 @@ void usage() {
 }
 
 void load_disk(const char *fname);
+
 void persist_disk();
+void persist_wait();
+void save_state(const char *fname);
+bool load_state(const char *fname);
 
 void load_symbols() {
     if (symbols_file.empty()) return;
@@ -449,6 +1052,470 @@ void load_symbols() {
     file.close();
 }
 
+// SDL window and input, only used when not headless
+Display display;
+SDL_Keycode last_key = 0;
+
+// Capture one video pixel (clk_vga && video_ce), handle VSYNC
+template <unsigned F>
+static void capture_video() {
+    if (tb.video_vsync && !vsync_r) {
+        x = 0; y = 0;
+        x_cnt++; y_cnt++;
+
+        // detect video resolution change
+        static const vector<pair<int,int>> resolutions = 
+            {{720,400}, {360,400}, {640,344},                                    // text modes
+             {640,480}, {640,400}, {640,200}, {640,350}, {320,200}, {320,240}};  // graphics modes
+        if ((x_cnt != resolution_x || y_cnt != resolution_y) && 
+               find(resolutions.begin(), resolutions.end(), pair<int,int>{x_cnt, y_cnt}) != resolutions.end()) {
+            printf("New video resolution: %d x %d\n", x_cnt, y_cnt);
+            resolution_x = x_cnt;
+            resolution_y = y_cnt;
+        }
+        monitors.fire(EV_VSYNC);
+
+        pix_cnt = 0; x_cnt = 0; y_cnt = 0;
+        speaker_active = false;
+        
+        if constexpr (F & F_SDL) {
+            // FPS calculation using wall clock time
+            if (fps_frame_count == 0) {
+                fps_start_time = get_ticks_ms();
+            }
+            fps_frame_count++;
+            
+            // Display FPS every 10 frames
+            if (fps_frame_count % 10 == 0) {
+                uint32_t current_time = get_ticks_ms();
+                uint32_t elapsed_ms = current_time - fps_start_time;
+                double fps = (double)fps_frame_count / (elapsed_ms / 1000.0);
+                printf("%8lld: FPS: %.2f (frames=%d, time=%.3fs)\n", sim_time, fps, fps_frame_count, elapsed_ms / 1000.0);
+            }
+            
+            // hand the frame to the main thread and draw the next one into the
+            // other buffer, or keep drawing into this one if the last is still shown
+            string title = "ao486 sim - frame " + to_string(frame_count) + (trace_toggle ? " tracing" : "") + (speaker_active ? " speaker" : "");
+            if (display.present(screenbuffer, resolution_x, resolution_y, title.c_str()))
+                screenbuffer = framebuffers[screenbuffer == framebuffers[0]];
+        }
+        frame_count++;
+    } else if (!tb.video_blank_n) {
+        x=0;
+        if (blank_n_r) y++;
+    } else {
+        if (y < V_RES && x < H_RES) {
+            Pixel *p = &screenbuffer[y * H_RES + x];
+            p->a = 0xff;
+            p->r = tb.video_r;
+            p->g = tb.video_g;
+            p->b = tb.video_b;
+            if (p->r || p->g || p->b) {
+                // printf("Pixel at %d,%d\n", x, y);
+                pix_cnt++;
+            }
+            x_cnt = max(x_cnt, x);
+            y_cnt = max(y_cnt, y);
+        }
+        x++;
+    }
+    blank_n_r = tb.video_blank_n;
+    vsync_r = tb.video_vsync;
+
+    // detect speaker output
+    if (tb.speaker_out != speaker_out_r) {
+        speaker_active = true;
+    }
+    speaker_out_r = tb.speaker_out;
+}
+
+// process input events queued by the main thread
+static void poll_sdl() {
+    Display::Event e;
+    while (display.poll(e)) {
+        if (e.type == Display::Event::QUIT) {
+            quit_requested = true;
+            return;
+        }
+        if (e.type == Display::Event::KEY_DOWN && e.sym != last_key) {
+            if (e.mod & KMOD_LGUI) {
+                if (e.sym == SDLK_t) {
+                    // press WIN-T to toggle trace
+                    set_trace(!trace_toggle);
+                } else if (e.sym == SDLK_s) {
+                    // press WIN-S to backup disk content
+                    persist_disk();
+                } else if (e.sym == SDLK_p) {
+                    // press WIN-P to save a snapshot of the whole system
+                    save_state(save_state_file.empty() ? "sim.state" : save_state_file.c_str());
+                } else if (e.sym == SDLK_f) {
+                    // press WIN-F to dump the flight recorder
+                    fr_trigger("WIN-F");
+                } else if (e.sym == SDLK_b) {
+                    // press WIN-B to go back one --rewind interval
+                    if (!rewind_cycles)
+                        printf("WIN-B needs --rewind\n");
+                    else {
+                        rewind_target = sim_time > rewind_cycles * 4 ? sim_time - rewind_cycles * 4 : 0;
+                        loop_reconfigure = true;
+                    }
+                }
+            } else {
+                last_key = e.sym;
+                emit_event(EVT_KEY_PRESSED, 0, e.sym);
+                input_recorder.record(sim_time, true, e.sym);
+                if (ps2scancodes.find(e.sym) != ps2scancodes.end()) {
+                    queue_scancodes(ps2scancodes[e.sym].first);
+                }
+            }
+        }
+        if (e.type == Display::Event::KEY_UP) {
+            if (e.mod & KMOD_LGUI) {
+                // nothing
+            } else {
+                last_key = 0;
+                printf("Key up: %d\n", e.sym);
+                input_recorder.record(sim_time, false, e.sym);
+                if (ps2scancodes.find(e.sym) != ps2scancodes.end()) {
+                    queue_scancodes(ps2scancodes[e.sym].second);
+                }
+            }
+        }
+    }
+}
+
+// Main loop, specialized on the feature set F. Runs until `until`, or until
+// the feature set has to change (tracing toggled, monitor added, quit).
+
+template <unsigned F>
+static void sim_loop(uint64_t until) {
+    loop_until = until;
+    while (sim_time < until && !loop_reconfigure) {
+        step_t<F>();
+
+        if constexpr (F & F_IO) {
+            bool io_write_do = tb.system->cpu_io_write_do;
+            if (io_write_do && !cpu_io_write_do_r)
+                monitors.fire(EV_IO_WRITE);
+            cpu_io_write_do_r = io_write_do;
+            bool io_read_done = tb.system->cpu_io_read_done;
+            if (io_read_done && !cpu_io_read_done_r)
+                monitors.fire(EV_IO_READ);
+            cpu_io_read_done_r = io_read_done;
+        }
+
+        if constexpr (F & F_EIP) {
+            uint32_t eip = tb.system->ao486->exe_eip;
+            if (eip != eip_r) {
+                monitors.fire(EV_EIP);
+                eip_r = eip;
+            }
+        }
+
+        if constexpr (F & F_POSEDGE) {
+            if (posedge)
+                monitors.fire(EV_POSEDGE);
+        }
+
+        if constexpr (F & F_VIDEO) {
+            if (sim.vga_gated) {
+                if (sim.vsync_start) {
+                    monitors.fire(EV_VSYNC);
+                    frame_count++;      // as capture_video() does
+                }
+            } else if (tb.clk_vga && tb.video_ce)
+                capture_video<F>();
+        }
+
+        if constexpr (F & F_SDL) {
+            if (sim_time % 100 == 0) {
+                poll_sdl();
+                if (quit_requested) return;
+            }
+        }
+    }
+}
+
+typedef void (*SimLoop)(uint64_t);
+
+template <size_t... I>
+static constexpr array<SimLoop, sizeof...(I)> make_sim_loops(index_sequence<I...>) {
+    return {{ &sim_loop<I>... }};
+}
+static const array<SimLoop, F_ALL + 1> sim_loops = make_sim_loops(make_index_sequence<F_ALL + 1>());
+
+static unsigned loop_features() {
+    unsigned f = 0;
+    if (monitors.has(EV_POSEDGE)) f |= F_POSEDGE;
+    if (monitors.has(EV_IO_WRITE) || monitors.has(EV_IO_READ)) f |= F_IO;
+    if (monitors.has(EV_EIP)) f |= F_EIP;
+    if (monitors.has(EV_VSYNC) || !g_headless) f |= F_VIDEO;
+    if (!g_headless && !fr_replaying) f |= F_SDL;
+    if (trace_toggle) f |= F_TRACE;
+    if (bench) f |= F_BENCH;
+    return f;
+}
+
+void fr_snapshot();
+void fr_dump(const char *reason);
+uint64_t fr_next = UINT64_MAX;      // sim_time of the next flight recorder snapshot
+void rewind_snapshot();
+bool rewind_to(uint64_t target);
+void gdb_reverse_run(bool step);
+
+void run_simulation() {
+    while (sim_time < stop_time && !quit_requested) {
+        while (gdb_reverse) {
+            bool step = gdb_reverse == 2;
+            gdb_reverse = 0;
+            gdb_reverse_run(step);      // ends in gdb_stopped(), which may ask again
+        }
+        if (rewind_target != UINT64_MAX) {
+            rewind_to(rewind_target);
+            rewind_target = UINT64_MAX;
+        }
+        // stop at start_time to turn tracing on, at the end of a --trace-for window,
+        // and for flight recorder and rewind snapshots
+        uint64_t until = stop_time;
+        if (start_time > sim_time && start_time < until) until = start_time;
+        if (trace_toggle && trace_stop_time < until) until = trace_stop_time;
+        if (fr_next < until) until = fr_next;
+        if (rewind_next < until) until = rewind_next;
+        bool at_start = until == start_time;
+        loop_reconfigure = false;
+        sim_loops[loop_features()](until);
+        // >=: with --vga-gate time moves in steps of 2
+        if (at_start && sim_time >= start_time) {
+            set_trace(true);
+        }
+        if (trace_toggle && sim_time >= trace_stop_time) {
+            printf("%8lld: Trace off: --trace-for %llu\n", sim_time, (unsigned long long)trace_for);
+            set_trace(false);
+        }
+        if (fr_reason || failure >= 0 && fr_cycles) {
+            fr_dump(fr_reason ? fr_reason : "failure");
+            fr_reason = nullptr;
+        }
+        if (failure >= 0) {
+            printf("%8lld: Simulation failed (%d)\n", sim_time, failure);
+            break;
+        }
+        if (sim_time >= fr_next)
+            fr_snapshot();
+        if (sim_time >= rewind_next)
+            rewind_snapshot();
+        if (watch_snapshot) {
+            char fname[64];
+            snprintf(fname, sizeof(fname), "watch_%llu.state", (unsigned long long)sim_time);
+            save_state(fname);
+            watch_snapshot = false;
+        }
+    }
+}
+
+// --jobs: boot a list of images on separate machines, --pool-threads at a
+// time, each to its stop time or CPU shutdown. Machines booting the same
+// image share its clean pages. One result line per job, in job file order.
+int run_jobs(const string &fname, int threads) {
+    struct Job {
+        string image;
+        uint64_t stop;
+        bool fast, vga_gate;
+        string result;
+    };
+    vector<Job> jobs;
+    ifstream in(fname);
+    if (!in) {
+        printf("Cannot open job file %s\n", fname.c_str());
+        return 1;
+    }
+    string line;
+    while (getline(in, line)) {
+        istringstream ls(line);
+        Job j = {"", 0, false, false, ""};
+        string opt;
+        if (!(ls >> j.image) || j.image[0] == '#') continue;
+        if (!(ls >> j.stop)) {
+            printf("Bad job line, need <image> <stop_time> [fast-boot] [vga-gate]: %s\n", line.c_str());
+            return 1;
+        }
+        while (ls >> opt) {
+            if (opt == "fast-boot") j.fast = true;
+            else if (opt == "vga-gate") j.vga_gate = true;
+            else {
+                printf("Unknown job option: %s\n", opt.c_str());
+                return 1;
+            }
+        }
+        jobs.push_back(j);
+    }
+
+    threads = max(1, min<int>(threads, jobs.size()));
+    printf("Running %zu jobs on %d threads\n", jobs.size(), threads);
+    atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < jobs.size();) {
+            Job &j = jobs[i];
+            Simulator m("job" + to_string(i));
+            m.vga_gated = j.vga_gate;
+            auto t0 = chrono::steady_clock::now();
+            bool booted = m.boot(j.image, j.fast);
+            if (booted) m.run(j.stop);
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+            string screen = m.screen_out.substr(m.screen_out.size() > 60 ? m.screen_out.size() - 60 : 0);
+            for (char &c : screen)
+                if (c < 32 || c > 126) c = ' ';
+            char buf[256];
+            snprintf(buf, sizeof(buf), "job %zu %s: %s, time %llu, POST %02x%s, %.0f cycles/s, screen \"%s\"",
+                     i, j.image.c_str(), !booted ? "boot failed" : m.shutdown ? "shutdown" : "done",
+                     (unsigned long long)m.time, m.post_code & 0xff, m.post_code < 0 ? " (none)" : "",
+                     m.time / 4 / max(secs, 1e-9), screen.c_str());
+            j.result = buf;
+        }
+    };
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++)
+        pool.emplace_back(worker);
+    for (thread &t : pool)
+        t.join();
+
+    int failed = 0;
+    for (const Job &j : jobs) {
+        printf("%s\n", j.result.c_str());
+        failed += j.result.find(": done") == string::npos;
+    }
+    return failed ? 1 : 0;
+}
+
+// <dir>/<name>.<file>: a fork job's own copy of an output file
+static string job_file(const string &name, const string &path) {
+    size_t base = path.rfind('/') == string::npos ? 0 : path.rfind('/') + 1;
+    return path.substr(0, base) + name + "." + path.substr(base);
+}
+
+// --fork-server: the machine has run to -e. Each job line read from fname,
+//   <name> <stop_time>|+<cycles> [input=<script>] [log=<file>] [event-log=<file>] [save-state=<file>]
+// becomes a fork()ed child, --pool-threads at a time, which continues to its
+// own stop time with its own input script and output files, stdout going to
+// <name>.log. Files of the server's own options (--cpi, --callgraph, --bench,
+// --dump-mem, --console-file...) are renamed to <name>.<file> in the child.
+// SDRAM, the disk mapping and the model are copy-on-write, so a job costs only
+// the pages it changes. Returns in the child with fork_child
+// set, in the server once fname is at EOF and all jobs have finished.
+int fork_server(const string &fname) {
+    if (trace_toggle) {                 // a ,trace watchpoint hit, the jobs would share the FST
+        printf("%8lld: Fork server: tracing to %s, not forking\n", sim_time, trace_file.c_str());
+        return 1;
+    }
+    FILE *in = fname == "-" ? stdin : fopen(fname.c_str(), "r");
+    if (!in) {
+        perror(fname.c_str());
+        return 1;
+    }
+    struct Running { string name, log; chrono::steady_clock::time_point start; };
+    map<pid_t, Running> running;
+    int jobs = 0, failed = 0;
+    auto reap = [&]() {
+        int status;
+        pid_t pid = wait(&status);
+        auto it = running.find(pid);
+        if (pid < 0 || it == running.end()) return;
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - it->second.start).count();
+        bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (WIFSIGNALED(status))
+            printf("Fork job %s: killed by signal %d after %.2fs, log %s\n", it->second.name.c_str(), WTERMSIG(status),
+                   secs, it->second.log.c_str());
+        else
+            printf("Fork job %s: %s in %.2fs, log %s\n", it->second.name.c_str(), ok ? "done" : "failed", secs,
+                   it->second.log.c_str());
+        fflush(stdout);
+        failed += !ok;
+        running.erase(it);
+    };
+
+    printf("%8lld: Fork server: reading jobs from %s, %d at a time\n", sim_time, fname.c_str(), pool_threads);
+    fflush(stdout);
+    char buf[4096];
+    uint64_t boot_time = sim_time;
+    while (fgets(buf, sizeof(buf), in)) {
+        istringstream ls(buf);
+        string name, stop, opt, input, log, evlog, state;
+        if (!(ls >> name) || name[0] == '#') continue;
+        if (!(ls >> stop) || !isdigit((unsigned char)stop[stop[0] == '+'])) {
+            printf("Bad fork job line, need <name> <stop_time>|+<cycles> [options]: %s", buf);
+            continue;
+        }
+        bool bad = false;
+        while (ls >> opt) {
+            size_t eq = opt.find('=');
+            string key = opt.substr(0, eq), val = eq == string::npos ? "" : opt.substr(eq + 1);
+            if (key == "input") input = val;
+            else if (key == "log") log = val;
+            else if (key == "event-log") evlog = val;
+            else if (key == "save-state") state = val;
+            else bad = true;
+            bad |= val.empty();
+        }
+        if (bad) {
+            printf("Bad fork job option in: %s", buf);
+            continue;
+        }
+        if (log.empty()) log = name + ".log";
+        uint64_t stop_at = stop[0] == '+' ? boot_time + strtoull(stop.c_str() + 1, nullptr, 0) * 4
+                                          : strtoull(stop.c_str(), nullptr, 0);
+
+        while ((int)running.size() >= pool_threads)
+            reap();
+        fflush(nullptr);                // or the children write the buffered output again
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            break;
+        }
+        if (pid == 0) {
+            if (in != stdin) fclose(in);
+            int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                perror(log.c_str());
+                _exit(1);
+            }
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+            fork_child = true;
+            stop_time = stop_at;
+            save_state_file = state;
+            for (string *f : {&cpi_file, &profile_folded, &callgraph_file, &bench_file, &trace_file})
+                if (!f->empty()) *f = job_file(name, *f);
+            for (MemDump &d : mem_dumps)
+                d.file = job_file(name, d.file);
+            if (!console_file.empty()) {
+                text_console.close();
+                console_file = job_file(name, console_file);
+                if (!text_console.open(console_file, svGetScopeFromName("TOP.system.vga"))) _exit(1);
+            }
+            if (!input.empty()) {
+                input_script = InputScript();
+                if (!input_script.load(input.c_str())) _exit(1);
+                input_script_on = true;
+            }
+            if (!evlog.empty()) {
+                event_log_file = evlog;
+                if (!event_log.open(evlog.c_str())) _exit(1);
+            }
+            printf("%8lld: Fork job %s, running to %llu\n", sim_time, name.c_str(), (unsigned long long)stop_time);
+            return 0;
+        }
+        running[pid] = {name, log, chrono::steady_clock::now()};
+        jobs++;
+    }
+    if (in != stdin) fclose(in);
+    while (!running.empty())
+        reap();
+    printf("Fork server: %d jobs, %d failed\n", jobs, failed);
+    return failed ? 1 : 0;
+}
+
 int main(int argc, char** argv) {
     Verilated::commandArgs(argc, argv);
 
@@ -457,6 +1524,7 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    bool trace_now = false;
     for (int i = 1; i < argc; i++) {
         string arg(argv[i]);
         if (arg == "-s") {
@@ -464,7 +1532,15 @@ int main(int argc, char** argv) {
         } else if (arg == "-e") {
             stop_time = atoi(argv[++i]);
         } else if (arg == "--trace") {
-            set_trace(true);
+            trace_now = true;           // after all options, --trace-scope applies to it
+        } else if (arg == "--trace-on" || arg == "--trace-off") {
+            if (!trace_triggers.add(argv[++i], arg == "--trace-on"))
+                return 1;
+        } else if (arg == "--trace-for") {
+            trace_for = strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--trace-scope") {
+            trace_scopes += trace_scopes.empty() ? "" : ",";
+            trace_scopes += argv[++i];
         } else if (arg == "--headless") {
             g_headless = true;
         } else if (arg == "--vga") {
@@ -477,9 +1553,101 @@ int main(int argc, char** argv) {
             trace_sound = true;
         } else if (arg == "--record") {
             record_audio = true;
+        } else if (arg == "--audio") {
+            play_audio = true;
         } else if (arg == "--mem") {
             // Support decimal or hex (0x...) addresses
-            watch_memory.insert(strtol(argv[++i], nullptr, 0) >> 2);
+            uint32_t addr = strtoul(argv[++i], nullptr, 0) & ~3u;
+            if (!watchpoints.add({addr, addr + 3, Watchpoints::WRITE, 0xf, Watchpoints::LOG}))
+                return 1;
+        } else if (arg == "--dump-mem") {
+            string spec = argv[++i];
+            size_t comma = spec.find(',');
+            MemDump d;
+            if (comma == string::npos || !parse_range(spec.substr(0, comma), d.lo, d.hi)) {
+                printf("Bad --dump-mem range: %s\n", spec.c_str());
+                return 1;
+            }
+            d.file = spec.substr(comma + 1);
+            mem_dumps.push_back(d);
+        } else if (arg == "--watch") {
+            if (!watchpoints.parse(argv[++i]))
+                return 1;
+        } else if (arg == "--quiet") {
+            quiet = true;
+        } else if (arg == "--bench") {
+            bench_file = argv[++i];
+            g_headless = true;
+        } else if (arg == "--overlay") {
+            overlay_file = argv[++i];
+        } else if (arg == "--save-state") {
+            save_state_file = argv[++i];
+        } else if (arg == "--load-state") {
+            load_state_file = argv[++i];
+        } else if (arg == "--input-script") {
+            if (!input_script.load(argv[++i]))
+                return 1;
+            input_script_on = true;
+        } else if (arg == "--record-input") {
+            if (!input_recorder.open(argv[++i]))
+                return 1;
+        } else if (arg == "--profile") {
+            profile_interval = max(1, atoi(argv[++i]));
+        } else if (arg == "--profile-top") {
+            profile_top = atoi(argv[++i]);
+        } else if (arg == "--profile-folded") {
+            profile_folded = argv[++i];
+        } else if (arg == "--fast-boot") {
+            fast_boot = true;
+        } else if (arg == "--vga-gate") {
+            sim.vga_gated = true;
+        } else if (arg == "--console") {
+            console_on = true;
+        } else if (arg == "--console-file") {
+            console_on = true;
+            console_file = argv[++i];
+        } else if (arg == "--idle-skip") {
+            idle_skip_on = true;
+        } else if (arg == "--jobs") {
+            jobs_file = argv[++i];
+        } else if (arg == "--fork-server") {
+            fork_server_file = argv[++i];
+        } else if (arg == "--pool-threads") {
+            pool_threads = atoi(argv[++i]);
+        } else if (arg == "--gdb") {
+            gdb_port = atoi(argv[++i]);
+        } else if (arg == "--callgraph") {
+            callgraph_file = argv[++i];
+        } else if (arg == "--disk-latency") {
+            char *end;
+            sim.disk_latency = strtoul(argv[++i], &end, 0);
+            if (*end == ',') sim.disk_sector_latency = strtoul(end + 1, nullptr, 0);
+        } else if (arg == "--event-log") {
+            event_log_file = argv[++i];
+        } else if (arg == "--cpi") {
+            cpi_file = argv[++i];
+        } else if (arg == "--perf") {
+            perf = true;
+        } else if (arg == "--perf-frame") {
+            perf = perf_frame = true;
+        } else if (arg == "--capture") {
+            capture_path = argv[++i];
+        } else if (arg == "--capture-every") {
+            capture_every = atoi(argv[++i]);
+        } else if (arg == "--capture-changed") {
+            capture_changed = true;
+        } else if (arg == "--flight-recorder") {
+            fr_cycles = strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--fr-post") {
+            fr_post = strtol(argv[++i], nullptr, 16);
+        } else if (arg == "--fr-exc") {
+            fr_exc = strtol(argv[++i], nullptr, 0);
+        } else if (arg == "--fr-out") {
+            fr_prefix = argv[++i];
+        } else if (arg == "--rewind") {
+            rewind_cycles = strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--rewind-depth") {
+            rewind_history.set_depth(atoi(argv[++i]));
         } else if (arg == "--symbols") {
             symbols_file = argv[++i];
             load_symbols();
@@ -492,45 +1660,54 @@ int main(int argc, char** argv) {
             break;
         }
     }
-    
+
+    if (!jobs_file.empty())
+        return run_jobs(jobs_file, pool_threads);
     if (disk_file.empty()) {
         usage();
         return 1;
     }
-
-    SDL_Window *sdl_window = NULL;
-    SDL_Renderer *sdl_renderer = NULL;
-    SDL_Texture *sdl_texture = NULL;
+#if !SIM_SAVABLE
+    if (fr_cycles || rewind_cycles) {
+        printf("--flight-recorder and --rewind need snapshots, build with THREADS=1 (--savable)\n");
+        return 1;
+    }
+#endif
+    if (sim.vga_gated && (!g_headless || !capture_path.empty())) {
+        printf("--vga-gate produces no pixels, it needs --headless and no --capture\n");
+        return 1;
+    }
+    if (!fork_server_file.empty() && (!g_headless || gdb_port || fr_cycles || rewind_cycles || play_audio ||
+                                      record_audio || !event_log_file.empty() || !capture_path.empty() ||
+                                      trace_now || start_time != UINT64_MAX || !trace_triggers.empty() ||
+                                      tb.contextp()->threads() > 1)) {
+        // fork() only copies the calling thread, and the jobs must not share snapshot fds or an open FST
+        printf("--fork-server needs --headless and a single-threaded model, and no --gdb, --flight-recorder, "
+               "--rewind, --audio, --record, --event-log, --capture, --trace, -s or --trace-on/--trace-off\n");
+        return 1;
+    }
+    if (idle_skip_on && !sim.vga_gated) {
+        printf("--idle-skip needs --vga-gate, the VGA timing it jumps over is the modelled one\n");
+        return 1;
+    }
+    if (trace_triggers.uses(TraceTriggers::WATCH) && watchpoints.empty()) {
+        printf("Trace condition watch needs a --watch or --mem\n");
+        return 1;
+    }
+#if !VM_TRACE
+    if (trace_now || start_time != UINT64_MAX || !trace_triggers.empty() || fr_cycles) {
+        printf("This build has no tracing (make fast), use obj_dir/Vsystem for --trace, -s, --trace-on/--trace-off "
+               "and --flight-recorder\n");
+        return 1;
+    }
+#endif
+    if (trace_now)
+        set_trace(true);
 
     if (!g_headless) {
-        if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-            printf("SDL init failed.\n");
-            return 1;
-        }
-        sdl_window = SDL_CreateWindow("z86 sim", SDL_WINDOWPOS_CENTERED,
-                                      SDL_WINDOWPOS_CENTERED, 800, 600, SDL_WINDOW_SHOWN);
-        if (!sdl_window) {
-            printf("Window creation failed: %s\n", SDL_GetError());
-            return 1;
-        }
-        sdl_renderer = SDL_CreateRenderer(sdl_window, -1,
-                                          SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-        if (!sdl_renderer) {
-            printf("Renderer creation failed: %s\n", SDL_GetError());
-            return 1;
-        }
-        sdl_texture = SDL_CreateTexture(sdl_renderer, SDL_PIXELFORMAT_RGBA8888,
-                                        SDL_TEXTUREACCESS_TARGET, H_RES, V_RES);
-        if (!sdl_texture) {
-            printf("Texture creation failed: %s\n", SDL_GetError());
+        // window, rendering and event polling run on their own thread
+        if (!display.start(H_RES, V_RES))
             return 1;
-        }
-
-        SDL_UpdateTexture(sdl_texture, NULL, screenbuffer, H_RES * sizeof(Pixel));
-        SDL_RenderClear(sdl_renderer);
-        SDL_RenderCopy(sdl_renderer, sdl_texture, NULL, NULL);
-        SDL_RenderPresent(sdl_renderer);
-        SDL_StopTextInput(); // for SDL_KEYDOWN
     } else {
         printf("Headless mode: SDL disabled.\n");
     }
@@ -540,396 +1717,757 @@ int main(int argc, char** argv) {
     // Initialize WAV writer for DSP output capture (if requested)
     if (record_audio) {
         wav_writer = new WAVWriter("dsp.wav", AUDIO_SAMPLE_RATE, 2, 16);
-        printf("Recording DSP output to dsp.wav at %d Hz\n", AUDIO_SAMPLE_RATE);
-    }
-
-    tb.clock_rate = 25000000;            // for time keeping of timer, RTC and floppy
-    tb.clock_rate_vga = 50000000;        // >= max VGA pixel clock (28.3Mhz)
-    ensure_posedge();
-    // reset whole system
-    tb.reset = 1;
-    full_step();
-
-    // CMOS and IDE init are now done in system.sv
-    // set amount of extended memory and date / time
-    // init_cmos();
-    // set HDD geometry and other parameters
-    // init_ide(disk_file.c_str(), 256*512);    // Hard disk MBR is at sector 256 
-
-    // load disk image into drive_sd_sim.sv
-    load_disk(disk_file.c_str());  
-    printf("C++ peek sd_buf[0..15]: ");
-    for (int i = 65536; i < 65536+16; ++i) {
-        printf("%02x ", tb.system->driver_sd->sd_buf[i]);
+        printf("Recording DSP and OPL3 output to dsp.wav at %d Hz\n", AUDIO_SAMPLE_RATE);
     }
-    printf("\n");    
-
-    // now release system reset - CPU will be released by boot loader when BIOS loading is complete
-    tb.reset = 0;
-
-    bool vsync_r = 0;
-    int x = 0;
-    int y = 0;
-    bool speaker_out_r = 0;
-    bool speaker_active = false;
-
-    bool post_need_newline = false;
-    int pix_cnt = 0;
-	vector<uint8_t> scancode;   // scancode
-	uint64_t last_scancode_time;
-    SDL_Keycode last_key = 0;
-
-    while (sim_time < stop_time) {
-        step();
+    if (play_audio && !audio_out.open(AUDIO_SAMPLE_RATE))
+        play_audio = false;
 
-        // watch memory locations
-        if (watch_memory.size() > 0) {
-            if (posedge && tb.system->avm_write && !mem_write_r && watch_memory.find(tb.system->avm_address) != watch_memory.end()) {
-                printf("%8lld: WRITE [%08x]=%08x, BE=%1x, EIP=%08x\n", sim_time, tb.system->avm_address << 2, tb.system->avm_writedata,
-                        tb.system->avm_byteenable, tb.system->ao486->exe_eip);
-            }
-            mem_write_r = tb.system->avm_write;
-        }
-
-        if (trace_ide)
-            print_ide_trace();
-
-        if (trace_sound)
-            print_sound_trace();
-
-        if (trace_vga)
-            print_vga_trace();
-
-        if (trace_symbols) {
-            print_symbol_trace();
-        }
-
-        // detect speaker output
-        if (tb.speaker_out != speaker_out_r) {
-            speaker_active = true;
-        }
-        speaker_out_r = tb.speaker_out;
-
-        // Capture Bochs BIOS debug (BX_VIRTUAL_PORTS) on port 0x8888
-        if (tb.system->cpu_io_write_do && !cpu_io_write_do_r && tb.system->cpu_io_write_address == 0x8888) {
-            uint8_t ch = tb.system->cpu_io_write_data & 0xFF;
-            printf("\033[33m"); // start yellow color
-            putchar(ch);
-            printf("\033[0m"); // reset color and newline
-        }
-        if (tb.system->cpu_io_write_do && !cpu_io_write_do_r && tb.system->cpu_io_write_address == 0x190) {
-            uint8_t code = tb.system->cpu_io_write_data & 0xFF;
-            printf("\033[35m"); // start purple color
-            printf("POST: %02x\n", code);
-            printf("\033[0m"); // reset color and newline
-        }        
-        cpu_io_write_do_r = tb.system->cpu_io_write_do;
-        cpu_io_read_do_r = tb.system->cpu_io_read_do;
-        cpu_io_read_done_r = tb.system->cpu_io_read_done;
-
-        // Sample DSP audio output every SAMPLE_DIVISOR clk_audio cycles
-        if (posedge) {
-            audio_sample_counter++;
-            if (audio_sample_counter >= SAMPLE_DIVISOR) {
-                audio_sample_counter = 0;
-                
-                // Get Sound Blaster DSP output samples
-                // Access the Sound Blaster DSP output directly from system ports
-                int16_t sample_l = (int16_t)tb.sample_sb_l;
-                int16_t sample_r = (int16_t)tb.sample_sb_r;
-                
-                if (wav_writer) {
-                    wav_writer->writeSample(sample_l, sample_r);
-                }
-            }
-        }
-
-        // Trace int 10h (Eh) to print character
-        if (tb.system->ao486->exe_eip == 0xA58 && eip_r != 0xA58 && tb.system->ao486->pipeline_inst->cs == 0xC000) {
-            uint32_t eax = tb.system->ao486->pipeline_inst->eax;
-            if ((eax >> 8 & 0xFF) == 0xE) {
-                if (sim_time - last_time > 1e5) {
-                    printf("%8lld: PRINT: ", sim_time);
-                }
-                printf("\033[32m%c\033[0m", eax & 0xFF);
-                last_time = sim_time;
-            }
+    if (!load_state_file.empty()) {
+        // resume from a snapshot: model, SDRAM, written disk sectors and harness state all come from the file
+        if (!load_state(load_state_file.c_str()))
+            return 1;
+    } else {
+        ensure_posedge();
+        // reset whole system
+        tb.reset = 1;
+        full_step();
+
+        // CMOS and IDE init are now done in system.sv
+        // set amount of extended memory and date / time
+        // init_cmos();
+        // set HDD geometry and other parameters
+        // init_ide(disk_file.c_str(), 256*512);    // Hard disk MBR is at sector 256 
+
+        // load disk image into drive_sd_sim.sv
+        load_disk(disk_file.c_str());  
+        printf("C++ peek disk[64K..64K+15]: ");
+        for (int i = 65536; i < 65536+16; i += 4) {
+            uint32_t d = sim.disk.read32(i);
+            printf("%02x %02x %02x %02x ", d & 0xff, d >> 8 & 0xff, d >> 16 & 0xff, d >> 24);
         }
-        // Trace int 13h disk accesses
-        if (tb.system->ao486->exe_eip == 0x85d3 && eip_r != 0x85d3 && tb.system->ao486->pipeline_inst->cs == 0xF000) {
-            uint32_t eax = tb.system->ao486->pipeline_inst->eax;
-            uint32_t ecx = tb.system->ao486->pipeline_inst->ecx;
-            uint32_t edx = tb.system->ao486->pipeline_inst->edx;
-            int cylinder = (ecx >> 8 & 0xFF) + ((ecx & 0xC0) << 2);
-            int head = edx >> 8 & 0xFF;
-            int sector = ecx & 0x3F;
-            int count = eax & 0xFF;
-            printf("%8lld: INT 13h: AX=%04x, CX=%04x, DX=%04x", sim_time, eax & 0xFFFF, ecx & 0xFFFF, edx & 0xFFFF);
-            printf(", C/H/S = %d/%d/%d, count=%d\n", cylinder, head, sector, count);
-        }
-        // Trace int 15h memory size detection
-        if (tb.system->ao486->exe_eip == 0xf85c && eip_r != 0xf85c && tb.system->ao486->pipeline_inst->cs == 0xF000) {
-            uint32_t eax = tb.system->ao486->pipeline_inst->eax;
-            uint32_t ecx = tb.system->ao486->pipeline_inst->ecx;
-            uint32_t edx = tb.system->ao486->pipeline_inst->edx;
-            printf("%8lld: INT 15h: AX=%04x, CX=%04x, DX=%04x\n", sim_time, eax & 0xFFFF, ecx & 0xFFFF, edx & 0xFFFF);
-        }
-        eip_r = tb.system->ao486->exe_eip;
-
-        // Capture video frame
-        if (tb.clk_vga && tb.video_ce) {
-            if (tb.video_vsync && !vsync_r) {
-                x = 0; y = 0;
-                x_cnt++; y_cnt++;
-                printf("%8lld: VSYNC: pix_cnt=%d, width=%d, height=%d, speaker=%s, CS:IP=%04x:%04x\n", sim_time, pix_cnt, x_cnt, y_cnt, speaker_active ? "ON" : "OFF", 
-                        tb.system->ao486->pipeline_inst->cs, tb.system->ao486->exe_eip);
-
-                // detect video resolution change
-                const vector<pair<int,int>> resolutions = 
-                    {{720,400}, {360,400}, {640,344},                                    // text modes
-                     {640,480}, {640,400}, {640,200}, {640,350}, {320,200}, {320,240}};  // graphics modes
-                if ((x_cnt != resolution_x || y_cnt != resolution_y) && 
-                       find(resolutions.begin(), resolutions.end(), pair<int,int>{x_cnt, y_cnt}) != resolutions.end()) {
-                    printf("New video resolution: %d x %d\n", x_cnt, y_cnt);
-                    resolution_x = x_cnt;
-                    resolution_y = y_cnt;
-                }
+        printf("\n");    
 
-                pix_cnt = 0; x_cnt = 0; y_cnt = 0;
-                speaker_active = false;
-                
-                // FPS calculation using wall clock time
-                if (!g_headless && fps_frame_count == 0) {
-                    fps_start_time = get_ticks_ms();
-                }
-                fps_frame_count++;
-                
-                // Display FPS every 10 frames
-                if (!g_headless && fps_frame_count % 10 == 0) {
-                    uint32_t current_time = get_ticks_ms();
-                    uint32_t elapsed_ms = current_time - fps_start_time;
-                    double fps = (double)fps_frame_count / (elapsed_ms / 1000.0);
-                    printf("%8lld: FPS: %.2f (frames=%d, time=%.3fs)\n", sim_time, fps, fps_frame_count, elapsed_ms / 1000.0);
-                }
-                
-                // update texture once per frame (in blanking)
-                if (!g_headless) {
-                    SDL_UpdateTexture(sdl_texture, NULL, screenbuffer, H_RES * sizeof(Pixel));
-                    SDL_RenderClear(sdl_renderer);
-                    const SDL_Rect srcRect = {0, 0, resolution_x, resolution_y};
-                    SDL_RenderCopy(sdl_renderer, sdl_texture, &srcRect, NULL);
-                    SDL_RenderPresent(sdl_renderer);
-                    SDL_SetWindowTitle(sdl_window, ("ao486 sim - frame " + to_string(frame_count) + (trace_toggle ? " tracing" : "") + (speaker_active ? " speaker" : "")).c_str());
-                }
-                frame_count++;
-            } else if (!tb.video_blank_n) {
-                x=0;
-                if (blank_n_r) y++;
-            } else {
-                if (y < V_RES && x < H_RES) {
-                    Pixel *p = &screenbuffer[y * H_RES + x];
-                    p->a = 0xff;
-                    p->r = tb.video_r;
-                    p->g = tb.video_g;
-                    p->b = tb.video_b;
-                    if (p->r || p->g || p->b) {
-                        // printf("Pixel at %d,%d\n", x, y);
-                        pix_cnt++;
-                    }
-                    x_cnt = max(x_cnt, x);
-                    y_cnt = max(y_cnt, y);
-                }
-                x++;
-            }
-            blank_n_r = tb.video_blank_n;
-            vsync_r = tb.video_vsync;
-        }
+        // now release system reset - CPU will be released by boot loader when BIOS loading is complete
+        tb.reset = 0;
+        if (fast_boot && !sim.fast_boot())
+            return 1;
+    }
 
-        // start / stop tracing
-        if (sim_time == start_time) {
-            set_trace(true);
-        }
-        if (sim_time == stop_time) {
-            set_trace(false);
-        }
+    if (!event_log_file.empty() && !event_log.open(event_log_file.c_str()))
+        return 1;
 
-        // process SDL events
-        if (!g_headless && sim_time % 100 == 0) {
-            SDL_Event e;
-            if (SDL_PollEvent(&e)) {
-                if (e.type == SDL_QUIT) {
-                    break;
-                }
-                if (e.type == SDL_WINDOWEVENT) {
-                    if (e.window.event == SDL_WINDOWEVENT_CLOSE) {
-                        if (e.window.windowID == SDL_GetWindowID(sdl_window))
-                            break;
-                    }
-                }
-				if (e.type == SDL_KEYDOWN && e.key.keysym.sym != last_key) {
-                    if (e.key.keysym.mod & KMOD_LGUI) {
-                        if (e.key.keysym.sym == SDLK_t) {
-    	    				// press WIN-T to toggle trace
-                            set_trace(!trace_toggle);
-                        } else if (e.key.keysym.sym == SDLK_s) {
-                            // press WIN-S to backup disk content
-                            persist_disk();
-                        }
-                    } else {
-                        last_key = e.key.keysym.sym;
-                        printf("Key pressed: %d\n", e.key.keysym.sym);
-                        if (ps2scancodes.find(e.key.keysym.sym) != ps2scancodes.end()) {
-                            scancode.insert(scancode.end(), ps2scancodes[e.key.keysym.sym].first.begin(), ps2scancodes[e.key.keysym.sym].first.end());
-                        }
-                    }
-                }
-				if (e.type == SDL_KEYUP) {
-                    if (e.key.keysym.mod & KMOD_LGUI) {
-                        // nothing
-                    } else {
-                        last_key = 0;
-                        printf("Key up: %d\n", e.key.keysym.sym);
-	    				if (ps2scancodes.find(e.key.keysym.sym) != ps2scancodes.end()) {
-		    				scancode.insert(scancode.end(), ps2scancodes[e.key.keysym.sym].second.begin(), ps2scancodes[e.key.keysym.sym].second.end());
-			    		}
-                    }
-                }
-            }
-        }
+    // register monitors, the main loop only looks for events that have handlers
+    if (!quiet) {
+        monitors.add(EV_IO_WRITE, print_bios_debug);
+        monitors.add(EV_EIP, print_bios_calls);
+        monitors.add(EV_VSYNC, print_vsync);
+    }
+    if (trace_ide)
+        monitors.add(EV_IO_WRITE, print_ide_trace);
+    if (trace_sound) {
+        monitors.add(EV_IO_WRITE, print_sound_write);
+        monitors.add(EV_IO_READ, print_sound_read);
+        monitors.add(EV_POSEDGE, print_sound_irq);
+    }
+    if (trace_vga)
+        monitors.add(EV_IO_WRITE, print_vga_trace);
+    if (trace_symbols && !profile_interval)      // with --profile, symbols only name the report
+        monitors.add(EV_EIP, print_symbol_trace);
+    if (profile_interval)
+        monitors.add(EV_POSEDGE, profile_sample);
+    if (!callgraph_file.empty()) {
+        callgraph.begin(sim_time / 4);
+        monitors.add(EV_POSEDGE, callgraph_trace);
+    }
+    if (!watchpoints.empty())
+        monitors.add(EV_POSEDGE, watch_memory_trace);
+    if (trace_triggers.uses(TraceTriggers::EIP))
+        monitors.add(EV_EIP, trace_trigger_eip);
+    if (trace_triggers.uses(TraceTriggers::IO))
+        monitors.add(EV_IO_WRITE, trace_trigger_io);
+    if (trace_triggers.uses(TraceTriggers::FRAME))
+        monitors.add(EV_VSYNC, trace_trigger_frame);
+    if (!cpi_file.empty())
+        monitors.add(EV_POSEDGE, cpi_trace);
+    if (perf) {
+        monitors.add(EV_POSEDGE, perf_sample);
+        monitors.add(EV_IO_WRITE, perf_port);
+        if (perf_frame) monitors.add(EV_VSYNC, perf_frame_line);
+    }
+    if (wav_writer || play_audio)
+        monitors.add(EV_POSEDGE, sample_audio);
+    if (!capture_path.empty()) {
+        if (!capture.open(capture_path, capture_every, capture_changed))
+            return 1;
+        monitors.add(EV_VSYNC, capture_frame);
+    }
+    if (console_on) {
+        if (!text_console.open(console_file, svGetScopeFromName("TOP.system.vga")))
+            return 1;
+        monitors.add(EV_VSYNC, console_frame);
+    }
+    monitors.add(EV_POSEDGE, keyboard_service);
+    if (idle_skip_on)
+        monitors.add(EV_POSEDGE, idle_skip_check);      // after keyboard_service() queued its input
+    if (fr_cycles) {
+        if (fr_post >= 0)
+            monitors.add(EV_IO_WRITE, fr_check_post);
+        monitors.add(EV_POSEDGE, fr_check_cpu);
+        printf("Flight recorder: snapshot every %llu cycles\n", (unsigned long long)fr_cycles);
+        fr_snapshot();
+    }
+    if (rewind_cycles) {
+        printf("Rewind: snapshot every %llu cycles, WIN-B goes back one interval\n", (unsigned long long)rewind_cycles);
+        rewind_snapshot();
+        gdb.reverse = true;
+    }
 
-		// send scancode to ps2_device, one scancode takes about 1ms (we'll wait 2ms)
-        if (posedge) {
-            if (sim_time - last_scancode_time > 1e5  && !scancode.empty()) {
-                printf("%8lld: Sending scancode %d\n", sim_time, scancode.front());
-                last_scancode_time = sim_time;
-                tb.kbd_data = scancode.front();
-                tb.kbd_data_valid = 1;
-                scancode.erase(scancode.begin());
-            } else {
-                tb.kbd_data_valid = 0;
-            }
+    if (gdb_port) {
+        if (!gdb.start(gdb_port, &gdb_target))
+            return 1;
+        monitors.add(EV_POSEDGE, gdb_check);
+        gdb_eip_r = tb.system->ao486->pipeline_inst->eip;
+        gdb_stopped("S05");         // GDB gets control before the first cycle
+    }
 
-            if (tb.kbd_host_data & 0x100) {
-                uint8_t cmd = tb.kbd_host_data & 0xff;
-                printf("%8lld: Received keyboard command %d\n", sim_time, cmd);
-                tb.kbd_host_data_clear = 1;
-                if (cmd == 0xFF) {
-                    printf("%8lld: Keyboard reset\n", sim_time);
-                    scancode.push_back(0xFA);
-                    scancode.push_back(0xAA);
-                    last_scancode_time = sim_time;    // 0xFA is sent 1ms later
-                } else if (cmd >= 0xF0) {
-                    // respond to all commands with an ACK
-                    scancode.push_back(0xFA);
-                    last_scancode_time = sim_time;    // 0xFA is sent 1ms later
-                }
-            } else if (tb.kbd_host_data_clear) {
-                tb.kbd_host_data_clear = 0;
-            }
+    uint64_t run_start_time = sim_time;
+    auto run_start_wall = chrono::steady_clock::now();
+    if (!bench_file.empty()) {
+        bench = new Bench;
+        bench_stage = !tb.system->boot_done ? 0 : last_time == 0 ? 1 : 2;   // snapshots may start later
+        bench->begin(bench_stages[bench_stage], sim_time);
+        if (bench_stage < 1) monitors.add(EV_POSEDGE, bench_boot_done);
+        if (bench_stage < 2) monitors.add(EV_EIP, bench_first_print);
+    }
 
-        }
+    if (g_headless)
+        run_simulation();
+    else
+        display.run(run_simulation);    // SDL stays on the main thread, the simulation moves to a worker
+    if (!fork_server_file.empty() && failure < 0 && !quit_requested) {
+        int r = fork_server(fork_server_file);
+        if (!fork_child) return r;
+        run_start_time = sim_time;
+        run_start_wall = chrono::steady_clock::now();
+        run_simulation();
     }
     printf("Simulation stopped at time %lld\n", sim_time);
+    gdb.exited(failure > 0 ? failure : 0);
+    double run_secs = chrono::duration<double>(chrono::steady_clock::now() - run_start_wall).count();
+    uint64_t run_cycles = (sim_time - run_start_time) / 4;      // 4 steps per clk_sys cycle
+    printf("Simulation speed: %.0f cycles/s (%llu clk_sys cycles in %.2fs, %d threads)\n",
+           run_secs > 0 ? run_cycles / run_secs : 0.0, (unsigned long long)run_cycles, run_secs,
+           (int)tb.contextp()->threads());
+
+    if (bench) {
+        bench->end(sim_time);
+        bench->write_json(bench_file.c_str(), disk_file, stop_time, tb.contextp()->threads());
+        delete bench;
+        bench = nullptr;
+    }
+
+    if (profile_interval) {
+        profiler.report(stdout, symbols, profile_top);
+        if (!profile_folded.empty() && profiler.write_folded(profile_folded.c_str(), symbols))
+            printf("Folded stacks written to %s\n", profile_folded.c_str());
+    }
+    if (!callgraph_file.empty())
+        callgraph.write(callgraph_file.c_str(), sim_time / 4);
+    if (!watchpoints.empty())
+        watchpoints.report();
+    if (perf)
+        perf_counters.report(stdout);
+    if (idle_skip_on)
+        printf("Idle skip: %llu jumps, %llu clk_sys cycles not evaluated\n", (unsigned long long)idle_skip.skips,
+               (unsigned long long)idle_skip.cycles);
+    if (sim.disk.commands)
+        printf("SD: %llu commands, %llu sectors read, %llu sectors written\n", (unsigned long long)sim.disk.commands,
+               (unsigned long long)sim.disk.sectors_read, (unsigned long long)sim.disk.sectors_written);
+    if (!cpi_file.empty()) {
+        cpi.report(stdout, 20);
+        if (cpi.write(cpi_file.c_str()))
+            printf("CPI table written to %s\n", cpi_file.c_str());
+    }
+    for (const MemDump &d : mem_dumps)
+        if (guest_mem.dump(d.lo, d.hi - d.lo + 1, d.file.c_str()))
+            printf("Memory %08x-%08x written to %s\n", d.lo, d.hi, d.file.c_str());
+
+    if (!save_state_file.empty())
+        save_state(save_state_file.c_str());
 
     // Cleanup
+    if (event_log.is_open()) {
+        event_log.close();
+        printf("%llu events written to %s (ring full %llu times)\n", (unsigned long long)event_log.count,
+               event_log_file.c_str(), (unsigned long long)event_log.stalls);
+    }
+    if (!g_headless)
+        display.stop();
+    capture.close();
+    text_console.close();
+    input_recorder.close();
+    persist_wait();
     if (wav_writer) {
         delete wav_writer;
         wav_writer = nullptr;
     }
+    audio_out.close();
     
+#if VM_TRACE
     if (trace) {
         trace->close();
         delete trace;
     }
-    return 0;
+#endif
+    return fork_child && failure >= 0 ? 1 : 0;
 }
 
+// --trace-scope "<path>[:<depth>],...": each path is an instance under
+// TOP.system (or a full name starting with TOP.), depth the levels of it to
+// dump, all by default. Verilator filters the signals when the file is opened.
 void set_trace(bool toggle) {
+#if !VM_TRACE
+    if (toggle) {                       // WIN-T or a ,trace watchpoint
+        printf("%8lld: Tracing is not compiled in, use obj_dir/Vsystem\n", sim_time);
+        return;
+    }
+#endif
     printf("Tracing %s\n", toggle ? "on" : "off");
+#if VM_TRACE
     if (toggle) {
         if (!trace) {
             trace = new VerilatedFstC;
-            tb.trace(trace, 5);
+            tb.trace(trace, trace_scopes.empty() ? 5 : 99);
             Verilated::traceEverOn(true);
             // printf("Tracing to waveform.fst\n");
-            trace->open("waveform.fst");    
+            stringstream ss(trace_scopes);
+            string scope;
+            while (getline(ss, scope, ',')) {
+                size_t colon = scope.find(':');
+                int depth = colon == string::npos ? 99 : max(1, atoi(scope.c_str() + colon + 1));
+                scope = scope.substr(0, colon);
+                if (scope.compare(0, 4, "TOP.") != 0) scope = "TOP.system." + scope;
+                printf("Tracing %s, %d levels\n", scope.c_str(), depth);
+                trace->dumpvars(depth, scope);
+            }
+            trace->open(trace_file.c_str());
         }
+        if (!fr_replaying)
+            trace_stop_time = trace_for ? sim_time + trace_for * 4 : UINT64_MAX;
     }
+#endif
     trace_toggle = toggle;
+    loop_reconfigure = true;            // main loop switches to/from the tracing variant
 }
 
-int disk_size;
-// Prototypes generated by Verilator from the exports
-extern "C" {
-    void sd_write(unsigned addr, const uint8_t data);
+static thread persist_thread;
+static const char OVERLAY_MAGIC[8] = {'A','O','4','8','6','O','V','1'};
+
+// DPI-C imports: driver_sd_sim.v reads and writes the card, see sd_disk.h
+extern "C" unsigned int sd_read(unsigned long long addr) {
+    Simulator *s = Simulator::from_scope();
+    return s ? s->disk.read32(addr) : 0;
 }
 
-static svScope sd_scope = nullptr;
+extern "C" void sd_write(unsigned long long addr, unsigned int data) {
+    if (Simulator *s = Simulator::from_scope())
+        s->disk.write32(addr, data);
+}
+
+extern "C" unsigned int sd_command(unsigned int write, unsigned int sector, unsigned int count) {
+    Simulator *s = Simulator::from_scope();
+    return s ? s->disk_command(write, sector, count) : 0;
+}
 
-// DPI-C call from verilog to load disk image
+// Replay an overlay written by persist_disk() on top of the loaded image.
+// Records are {uint32_t sector, 512 bytes}, later records win.
+static void load_overlay() {
+    FILE *f = fopen(overlay_file.c_str(), "rb");
+    if (!f) return;                 // no overlay yet
+    char magic[sizeof(OVERLAY_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, OVERLAY_MAGIC, sizeof(magic)) != 0) {
+        printf("%s is not a disk overlay, ignored\n", overlay_file.c_str());
+        fclose(f);
+        return;
+    }
+    uint32_t sector;
+    uint8_t buf[512];
+    int cnt = 0;
+    while (fread(&sector, sizeof(sector), 1, f) == 1 && fread(buf, 1, 512, f) == 512) {
+        if ((uint64_t)sector * 512 + 512 <= sim.disk.size()) {
+            sim.disk.load_sector(sector, buf);
+            cnt++;
+        }
+    }
+    fclose(f);
+    printf("Applied %d sectors from overlay %s\n", cnt, overlay_file.c_str());
+}
+// Map the disk image behind driver_sd_sim.v. Nothing is read until the guest
+// accesses it.
 void load_disk(const char *fname) {
-    unsigned blk_sz = 1024;
-    struct stat st;
     printf("Loading disk image from %s.\n", fname);
-    sd_scope = svGetScopeFromName("TOP.system.driver_sd");
-    if (!sd_scope) {
-        fprintf(stderr, "ERROR: scope TOP.system.driver_sd not found\n");
-        exit(1);
-    }    
-    svSetScope(sd_scope);
-
-    if (stat(fname, &st) != 0) { perror(fname); return; }
-    disk_size = st.st_size;
-
-    FILE* f = fopen(fname, "rb");
-    if (!f) { perror(fname); return; }
-
-    std::vector<uint8_t> buf(blk_sz);
-    unsigned addr = 0;
-    while (addr < disk_size) {
-        size_t n = fread(buf.data(), 1,
-                         std::min<unsigned>(blk_sz, disk_size - addr), f);
-        if (!n) break;
-        for (int i = 0; i < n; i++) {
-            // if (addr + i < 64) {  // Debug: show first 64 bytes being written
-            //     printf("SD_WRITE: addr=%x, data=%02x\n", addr + i, buf[i]);
-            // }
-            sd_write(addr + i, buf[i]);
-        }
-        addr += n;
+    if (!sim.load_disk(fname)) return;
+    if (!overlay_file.empty())
+        load_overlay();
+    printf("Disk image mapped for driver_sd_sim.v (%llu bytes)\n", (unsigned long long)sim.disk.size());
+}
+
+// Write dirty sectors from a background thread
+static void persist_worker(vector<uint32_t> sectors, vector<uint8_t> data) {
+    size_t n = sectors.size();
+    if (!overlay_file.empty()) {
+        FILE *f = fopen(overlay_file.c_str(), "ab");
+        if (!f) {
+            printf("Failed to open overlay %s for writing\n", overlay_file.c_str());
+            return;
+        }
+        if (ftell(f) == 0)
+            fwrite(OVERLAY_MAGIC, 1, sizeof(OVERLAY_MAGIC), f);
+        for (size_t i = 0; i < n; i++) {
+            fwrite(&sectors[i], sizeof(uint32_t), 1, f);
+            fwrite(&data[i * 512], 1, 512, f);
+        }
+        if (fclose(f) != 0) {
+            printf("Failed to write overlay %s\n", overlay_file.c_str());
+            return;
+        }
+        printf("%zu sectors appended to overlay %s\n", n, overlay_file.c_str());
+    } else {
+        int fd = open(disk_file.c_str(), O_WRONLY);
+        if (fd < 0) {
+            printf("Failed to open disk image for writing\n");
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (pwrite(fd, &data[i * 512], 512, (off_t)sectors[i] * 512) != 512) {
+                printf("Failed to write sector %u of disk image\n", sectors[i]);
+                break;
+            }
+        }
+        close(fd);
+        printf("%zu sectors persisted to %s\n", n, disk_file.c_str());
     }
-    fclose(f);
-    printf("Disk image loaded into driver_sd_sim.v\n");
 }
 
 void persist_disk() {
-    uint8_t buf[1024];
-    printf("Persisting disk image to %s.\n", disk_file.c_str());
-    svSetScope(sd_scope);
+    // one persist at a time, sectors dirtied meanwhile go with the next one
+    if (persist_thread.joinable())
+        persist_thread.join();
+
+    SdDisk &disk = sim.disk;
+    vector<uint32_t> sectors;
+    for (uint32_t i = 0; i < disk.sectors(); i++)
+        if (disk.dirty[i]) sectors.push_back(i);
+    if (sectors.empty()) {
+        printf("Disk image is up to date, nothing to persist\n");
+        return;
+    }
+    printf("%8lld: Persisting %zu dirty sectors to %s\n", sim_time, sectors.size(),
+           overlay_file.empty() ? disk_file.c_str() : overlay_file.c_str());
+
+    // copy the sectors on the simulation thread, so the worker never sees
+    // them change while the guest keeps writing
+    vector<uint8_t> data(sectors.size() * 512);
+    for (size_t i = 0; i < sectors.size(); i++) {
+        disk.read((uint64_t)sectors[i] * 512, &data[i * 512], 512);
+        disk.dirty[sectors[i]] = 0;
+    }
+    persist_thread = thread(persist_worker, move(sectors), move(data));
+}
+
+void persist_wait() {
+    if (persist_thread.joinable())
+        persist_thread.join();
+}
+
+#if SIM_SAVABLE
+// Snapshot format: header, harness state, the Verilated model (which includes
+// sdram.mem), then the key queue and the disk sectors written since the image
+// was opened. The model must be built with --savable, and a snapshot only
+// loads into the same Vsystem binary, with the same disk image.
+static const char STATE_MAGIC[8] = {'A','O','4','8','6','S','T','4'};
+
+template <class T> static void save_var(VerilatedSave &os, const T &v) { os.write(&v, sizeof(v)); }
+template <class T> static void load_var(VerilatedRestore &is, T &v) { is.read(&v, sizeof(v)); }
+
+// Write a snapshot, no console output unless it fails
+static bool write_state(const char *fname) {
+    VerilatedSave os;
+    os.open(fname);
+    if (!os.isOpen()) {
+        printf("Failed to open %s for writing\n", fname);
+        return false;
+    }
+    os.write(STATE_MAGIC, sizeof(STATE_MAGIC));
+
+    // harness state
+    save_var(os, sim_time); save_var(os, last_time); save_var(os, posedge);
+    uint64_t disk_size = sim.disk.size();
+    save_var(os, disk_size);
+    save_var(os, resolution_x); save_var(os, resolution_y);
+    save_var(os, x_cnt); save_var(os, y_cnt); save_var(os, x); save_var(os, y);
+    save_var(os, pix_cnt); save_var(os, frame_count);
+    save_var(os, vsync_r); save_var(os, blank_n_r);
+    save_var(os, sim.vga_timing);
+    save_var(os, speaker_out_r); save_var(os, speaker_active);
+    save_var(os, eip_r);
+    save_var(os, cpu_io_write_do_r); save_var(os, cpu_io_read_done_r);
+    save_var(os, crtc_reg); save_var(os, irq5_r); save_var(os, irq7_r);
+    save_var(os, audio_sample_counter);
+    save_var(os, last_scancode_time);
+    InputScript::Cursor script_pos = input_script.cursor();
+    save_var(os, script_pos);
+    uint32_t n = sim.disk.sectors();
+    save_var(os, n);
+    os.write(sim.disk.dirty.data(), n);
+    os.write(screenbuffer, sizeof(framebuffers[0]));
+
+    // Verilated model
+    os << tb;
+
+    // variable length parts last, so that the rest keeps its offsets (--rewind)
+    n = scancode.size();
+    save_var(os, n);
+    for (uint32_t i = 0; i < n; i++) save_var(os, scancode[i]);
+    vector<uint32_t> written = sim.disk.written_sectors();
+    n = written.size();
+    save_var(os, n);
+    for (uint32_t s : written) {
+        save_var(os, s);
+        os.write(sim.disk.sector(s), 512);
+    }
+    os.close();
+    return true;
+}
+
+static bool read_state(const char *fname) {
+    VerilatedRestore is;
+    is.open(fname);
+    if (!is.isOpen()) {
+        printf("Failed to open %s\n", fname);
+        return false;
+    }
+    char magic[sizeof(STATE_MAGIC)];
+    is.read(magic, sizeof(magic));
+    if (memcmp(magic, STATE_MAGIC, sizeof(magic)) != 0) {
+        printf("%s is not a simulator state file\n", fname);
+        return false;
+    }
+
+    load_var(is, sim_time); load_var(is, last_time); load_var(is, posedge);
+    uint64_t disk_size;
+    load_var(is, disk_size);
+    if (disk_size != sim.disk.size()) {
+        printf("%s was taken with a %llu byte disk image, %s is %llu bytes\n", fname,
+               (unsigned long long)disk_size, disk_file.c_str(), (unsigned long long)sim.disk.size());
+        return false;
+    }
+    load_var(is, resolution_x); load_var(is, resolution_y);
+    load_var(is, x_cnt); load_var(is, y_cnt); load_var(is, x); load_var(is, y);
+    load_var(is, pix_cnt); load_var(is, frame_count);
+    load_var(is, vsync_r); load_var(is, blank_n_r);
+    load_var(is, sim.vga_timing);
+    load_var(is, speaker_out_r); load_var(is, speaker_active);
+    load_var(is, eip_r);
+    load_var(is, cpu_io_write_do_r); load_var(is, cpu_io_read_done_r);
+    load_var(is, crtc_reg); load_var(is, irq5_r); load_var(is, irq7_r);
+    load_var(is, audio_sample_counter);
+    load_var(is, last_scancode_time);
+    InputScript::Cursor script_pos;
+    load_var(is, script_pos);
+    input_script.set_cursor(script_pos);
+    uint32_t n;
+    load_var(is, n);
+    vector<uint8_t> dirty(n);
+    is.read(dirty.data(), n);
+    is.read(screenbuffer, sizeof(framebuffers[0]));
+
+    is >> tb;
+
+    load_var(is, n);
+    scancode.clear();
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t c;
+        load_var(is, c);
+        scancode.push(c);
+    }
+    load_var(is, n);
+    vector<uint32_t> written(n);
+    vector<uint8_t> data((size_t)n * 512);
+    for (uint32_t i = 0; i < n; i++) {
+        load_var(is, written[i]);
+        is.read(&data[(size_t)i * 512], 512);
+    }
+    sim.disk.restore(written, data.data());
+    if (dirty.size() == sim.disk.sectors())
+        sim.disk.dirty = dirty;
+    is.close();
+    return true;
+}
+
+void save_state(const char *fname) {
+    printf("%8lld: Saving state to %s\n", sim_time, fname);
+    if (write_state(fname))
+        printf("State saved to %s\n", fname);
+}
+
+bool load_state(const char *fname) {
+    printf("Loading state from %s\n", fname);
+    // the snapshot has the written sectors, including any from the overlay.
+    // --input-script starts where this run's script is, not the saved one.
+    InputScript::Cursor script_pos = input_script.cursor();
+    if (!sim.load_disk(disk_file) || !read_state(fname))
+        return false;
+    input_script.set_cursor(script_pos);
+
+    printf("State loaded, resuming at time %lld\n", sim_time);
+    return true;
+}
+
+// Flight recorder. Tracing every cycle is ~10x slower than not tracing, so
+// instead the simulation runs untraced and takes a snapshot every fr_cycles
+// cycles into one of two scratch files. On a trigger it restores the older one, which
+// is between fr_cycles and 2*fr_cycles cycles back, and re-runs up to the
+// trigger with the FST open. The simulation is deterministic, and keyboard
+// input is replayed from fr_input, so the replay takes the same path.
+// Each snapshot is about the size of the model (~40MB, mostly sdram.mem).
+struct FrSlot { int fd = -1; string path; uint64_t time = 0; bool valid = false; };
+static FrSlot fr_slots[2];
+static int fr_newest = 1;
+
+// Snapshot scratch file that write_state() and read_state() can open by name.
+// On Linux it is a memfd, elsewhere a temporary file removed at exit.
+static vector<string> scratch_files;
+static void remove_scratch_files() {
+    for (const string &f : scratch_files) unlink(f.c_str());
+}
+
+static bool scratch_file(const char *name, int &fd, string &path) {
+#ifdef __linux__
+    fd = memfd_create(name, 0);
+    if (fd < 0) {
+        perror("memfd_create");
+        return false;
+    }
+    path = "/proc/self/fd/" + to_string(fd);
+#else
+    const char *dir = getenv("TMPDIR");
+    path = string(dir && *dir ? dir : "/tmp") + "/" + name + "-XXXXXX";
+    fd = mkstemp(&path[0]);
+    if (fd < 0) {
+        perror(path.c_str());
+        return false;
+    }
+    if (scratch_files.empty()) atexit(remove_scratch_files);
+    scratch_files.push_back(path);
+#endif
+    return true;
+}
+
+// Input older than the oldest snapshot is never replayed
+static void trim_input() {
+    uint64_t keep = sim_time;
+    for (const FrSlot &slot : fr_slots)
+        if (fr_cycles && slot.valid) keep = min(keep, slot.time);
+    if (!rewind_history.empty()) keep = min(keep, rewind_history.time(0));
+    size_t i = 0;
+    while (i < fr_input.size() && fr_input[i].time < keep) i++;
+    fr_input.erase(fr_input.begin(), fr_input.begin() + i);
+    i = 0;
+    while (i < fr_skips.size() && fr_skips[i].time < keep) i++;
+    fr_skips.erase(fr_skips.begin(), fr_skips.begin() + i);
+}
+
+// Replays print nothing, the monitors' console output was already printed the first time
+static int mute_stdout() {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    return saved;
+}
+
+static void unmute_stdout(int saved) {
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+void fr_snapshot() {
+    FrSlot &slot = fr_slots[fr_newest ^= 1];
+    if (slot.fd < 0) {
+        if (!scratch_file("ao486-flight-recorder", slot.fd, slot.path)) {
+            fr_cycles = 0;
+            fr_next = UINT64_MAX;
+            return;
+        }
+    }
+    slot.valid = write_state(slot.path.c_str());
+    slot.time = sim_time;
+    fr_next = sim_time + fr_cycles * 4;             // 4 steps per clk_sys cycle
+    trim_input();
+}
 
-    if (rename(disk_file.c_str(), (disk_file + ".bak").c_str()) != 0) {
-        printf("Failed to rename existing disk image to %s.bak\n", disk_file.c_str());
+void fr_dump(const char *reason) {
+    uint64_t trigger_time = sim_time;
+    if (trace_toggle) {
+        printf("%8lld: Flight recorder: %s, already tracing to %s\n", sim_time, reason, trace_file.c_str());
+        return;
+    }
+    const FrSlot *from = &fr_slots[fr_newest ^ 1];
+    if (!from->valid) from = &fr_slots[fr_newest];
+    if (!from->valid) {
+        printf("%8lld: Flight recorder: %s, no snapshot to replay from\n", sim_time, reason);
         return;
     }
-    printf("Existing disk image renamed to %s.bak\n", disk_file.c_str());
+    string fname = fr_prefix + "_" + to_string(trigger_time) + ".fst";
+    printf("%8lld: Flight recorder: %s, replaying from %lld to %s\n", sim_time, reason, from->time, fname.c_str());
+
+    int saved_stdout = mute_stdout();
+    int saved_failure = failure;
+    read_state(from->path.c_str());
+    fr_input_pos = 0;
+    while (fr_input_pos < fr_input.size() && fr_input[fr_input_pos].time < from->time) fr_input_pos++;
+    fr_skip_pos = 0;
+    fr_replaying = true;
+    string saved_trace_file = trace_file;
+    trace_file = fname;
+    set_trace(true);
+    while (sim_time < trigger_time) {
+        loop_reconfigure = false;
+        sim_loops[loop_features()](trigger_time);
+    }
+#if VM_TRACE
+    trace->close();
+    delete trace;
+    trace = nullptr;
+#endif
+    set_trace(false);
+    trace_file = saved_trace_file;
+    fr_replaying = false;
+    failure = saved_failure;
+
+    unmute_stdout(saved_stdout);
+    printf("%8lld: Flight recorder: wrote %lld cycles to %s\n", sim_time, (trigger_time - from->time) / 4, fname.c_str());
+}
 
-    // write new disk image
-    FILE* f = fopen(disk_file.c_str(), "wb");
-    if (!f) {
-        printf("Failed to open disk image for writing\n");
+// Rewind. Every rewind_cycles cycles write_state() goes to a scratch file and from
+// there into rewind_history, which keeps only the pages that changed. Going
+// back restores the newest snapshot at or before the target and re-runs up to
+// the target exactly, with input replayed from fr_input like the flight
+// recorder. The history after that point is dropped, because the simulation
+// goes its own way from there.
+static int rewind_fd = -1;
+static string rewind_file;
+static vector<uint8_t> rewind_buf;
+
+void rewind_snapshot() {
+    if (rewind_fd < 0 && !scratch_file("ao486-rewind", rewind_fd, rewind_file)) {
+        rewind_cycles = 0;
+        rewind_next = UINT64_MAX;
         return;
     }
-    for (int i = 0; i < disk_size; i += 1024) {
-        int n = std::min(1024, disk_size - i);
-        for (int j = 0; j < n; j++) {
-            buf[j] = tb.system->driver_sd->sd_buf[i+j];
-        }
-        if (fwrite(buf, 1, n, f) != (size_t)n) {
-            printf("Failed to write disk image\n");
-            fclose(f);
-            return;
+    struct stat st;
+    if (write_state(rewind_file.c_str()) && fstat(rewind_fd, &st) == 0) {
+        rewind_buf.resize(st.st_size);
+        if (pread(rewind_fd, rewind_buf.data(), st.st_size, 0) == st.st_size)
+            rewind_history.add(sim_time, rewind_buf.data(), st.st_size);
+    }
+    rewind_next = sim_time + rewind_cycles * 4;     // 4 steps per clk_sys cycle
+    trim_input();
+}
+
+// Restore snapshot i and run to `until` without side effects
+static bool rewind_replay(int i, uint64_t until) {
+    rewind_history.get(i, rewind_buf);
+    if (ftruncate(rewind_fd, 0) != 0 ||
+        pwrite(rewind_fd, rewind_buf.data(), rewind_buf.size(), 0) != (ssize_t)rewind_buf.size()) {
+        perror("rewind");
+        return false;
+    }
+    int saved_stdout = mute_stdout();
+    int saved_failure = failure;
+    bool ok = read_state(rewind_file.c_str());
+    if (ok) {
+        fr_input_pos = 0;
+        while (fr_input_pos < fr_input.size() && fr_input[fr_input_pos].time < sim_time) fr_input_pos++;
+        fr_skip_pos = 0;
+        gdb_eip_r = tb.system->ao486->pipeline_inst->eip;
+        fr_replaying = true;
+        while (sim_time < until) {
+            loop_reconfigure = false;
+            sim_loops[loop_features()](until);
         }
+        fr_replaying = false;
     }
-    fclose(f);
-    printf("Disk image persisted to %s\n", disk_file.c_str());
+    failure = saved_failure;
+    unmute_stdout(saved_stdout);
+    return ok;
+}
+
+// Go back to exactly `target`, which must be in the history
+bool rewind_to(uint64_t target) {
+    int i = rewind_history.find(target);
+    if (i < 0) {
+        printf("%8lld: Rewind: no snapshot at or before %llu\n", sim_time, (unsigned long long)target);
+        return false;
+    }
+    if (trace_toggle) {
+        printf("%8lld: Rewind: tracing off, the FST cannot go back in time\n", sim_time);
+        set_trace(false);
+    }
+    uint64_t from = sim_time;
+    if (!rewind_replay(i, target))
+        return false;
+
+    // what was after the target is another future now
+    rewind_history.truncate(i);
+    rewind_next = rewind_history.time(i) + rewind_cycles * 4;
+    fr_input.erase(fr_input.begin() + fr_input_pos, fr_input.end());
+    fr_skips.erase(fr_skips.begin() + fr_skip_pos, fr_skips.end());
+    for (FrSlot &slot : fr_slots)
+        if (slot.time > sim_time) slot.valid = false;
+    gdb_stop.clear();
+    printf("%8lld: Rewound from %llu, %zu snapshots (%zuMB) left\n", sim_time, (unsigned long long)from,
+           rewind_history.size(), rewind_history.bytes() >> 20);
+    return true;
+}
+
+// GDB bc/bs: replay the history window by window, newest first, and go to
+// the last stop (breakpoint, watchpoint or, stepping, any instruction) before
+// now. Without one the simulation goes to the oldest snapshot.
+void gdb_reverse_run(bool step) {
+    uint64_t now = sim_time;
+    int first = rewind_history.find(now ? now - 1 : 0);
+    gdb_scan = step ? 2 : 1;
+    gdb_scan_limit = now;
+    gdb_scan_hit = UINT64_MAX;
+    for (int i = first; i >= 0 && gdb_scan_hit == UINT64_MAX; i--) {
+        uint64_t until = i == first ? now : rewind_history.time(i + 1);
+        if (!rewind_replay(i, until)) break;
+    }
+    gdb_scan = 0;
+    string reason = "T05replaylog:begin;";
+    bool hit = gdb_scan_hit != UINT64_MAX;
+    if (hit) reason = gdb_scan_reason;
+    if (!rewind_history.empty() && rewind_to(hit ? gdb_scan_hit : rewind_history.time(0)))
+        gdb_eip_r = tb.system->ao486->pipeline_inst->eip;
+    gdb_stopped(reason);
+}
+#else
+void save_state(const char *fname) {
+    printf("Snapshots are not supported by this build (needs THREADS=1 / --savable)\n");
+}
+
+void fr_snapshot() {}
+void fr_dump(const char *reason) {}
+void rewind_snapshot() {}
+bool rewind_to(uint64_t target) { return false; }
+void gdb_reverse_run(bool step) {}
+
+bool load_state(const char *fname) {
+    printf("Snapshots are not supported by this build (needs THREADS=1 / --savable)\n");
+    return false;
 }
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+
+// Event-driven monitor dispatch for the simulation main loop.
+//
+// Monitors register a handler for the one event they care about. The main
+// loop is specialized at compile time on the set of events that have
+// handlers (plus display, tracing and benchmarking), so events nobody
+// listens to cost nothing, not even the signal reads to detect them.
+enum MonitorEvent {
+    EV_POSEDGE,         // rising edge of clk_sys
+    EV_IO_WRITE,        // rising edge of cpu_io_write_do
+    EV_IO_READ,         // rising edge of cpu_io_read_done
+    EV_EIP,             // exe_eip changed, eip_r still holds the previous value
+    EV_VSYNC,           // rising edge of video_vsync
+    EV_COUNT
+};
+
+typedef void (*MonitorHandler)();
+
+class Monitors {
+public:
+    // Handlers added while the simulation runs take effect once the main
+    // loop re-specializes, see loop_reconfigure in main.cpp
+    void add(MonitorEvent ev, MonitorHandler h) {
+        handlers[ev].push_back(h);
+    }
+
+    bool has(MonitorEvent ev) const { return !handlers[ev].empty(); }
+
+    void fire(MonitorEvent ev) const {
+        for (MonitorHandler h : handlers[ev]) h();
+    }
+
+private:
+    std::vector<MonitorHandler> handlers[EV_COUNT];
+};
@@ -0,0 +1,174 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "Vsystem_system.h"
+#include "Vsystem_ao486.h"
+#include "Vsystem_memory.h"
+#include "Vsystem_icache.h"
+#include "Vsystem_l1_icache.h"
+#include "Vsystem_tlb.h"
+#include "Vsystem_prefetch_fifo.h"
+
+// Microarchitectural counters for --perf, sampled once per clk_sys posedge
+// from public signals:
+// - L1 icache (l1_icache.v state): requests from icache.v, and the ones that
+//   needed at least one line fill
+// - TLB (tlb.v state, translate_valid): lookups with paging on, hits, and
+//   page walks. The lookup repeated after a walk counts as a hit.
+// - prefetch FIFO (prefetch_fifo.v): cycles fetch found it empty
+// - Avalon bus (system.sv avm_*): read latency from the request to the first
+//   data word, write latency from the request to its acceptance, both as
+//   power-of-two histograms. The CPU has one read burst in flight at a time.
+class PerfCounters {
+public:
+    struct Histogram {
+        static const int BUCKETS = 16;          // [0], [1], [2-3], ... [16384-]
+        uint64_t bucket[BUCKETS];
+        uint64_t n, sum, max;
+
+        void add(uint64_t v) {
+            int b = 0;
+            while (b < BUCKETS - 1 && v >= (1ull << b)) b++;
+            bucket[b]++;
+            n++;
+            sum += v;
+            if (v > max) max = v;
+        }
+        double mean() const { return n ? (double)sum / n : 0; }
+        // upper bound of the bucket holding quantile q, at most the max
+        uint64_t quantile(double q) const {
+            uint64_t acc = 0;
+            for (int b = 0; b < BUCKETS; b++)
+                if ((acc += bucket[b]) >= q * n && acc) return b ? std::min<uint64_t>((1ull << b) - 1, max) : 0;
+            return max;
+        }
+    };
+
+    struct Counts {
+        uint64_t cycles;
+        uint64_t ic_requests, ic_misses, ic_fills;
+        uint64_t tlb_lookups, tlb_hits, tlb_walks;
+        uint64_t pf_empty;
+        Histogram rd, wr;
+    };
+
+    PerfCounters() { reset(); }
+
+    void reset() {
+        memset(&c, 0, sizeof(c));
+        last = c;
+        rd_wait = wr_wait = -1;
+    }
+
+    void sample(const Vsystem_system &s) {
+        const Vsystem_memory &m = *s.ao486->memory_inst;
+        c.cycles++;
+
+        uint8_t ic = m.icache_inst->l1_icache_inst->state;
+        if (ic == IC_READONE && ic_state_r == IC_IDLE) {
+            c.ic_requests++;
+            ic_filled = false;
+        }
+        if (ic == IC_FILLCACHE && ic_state_r != IC_FILLCACHE) {
+            c.ic_fills++;
+            if (!ic_filled) c.ic_misses++;
+            ic_filled = true;
+        }
+        ic_state_r = ic;
+
+        uint8_t tlb = m.tlb_inst->state;
+        if (s.ao486->pipeline_inst->cr0_pg &&
+            (tlb == TLB_CODE_CHECK || tlb == TLB_CHECK_CHECK || tlb == TLB_WRITE_CHECK || tlb == TLB_READ_CHECK)) {
+            c.tlb_lookups++;
+            if (m.tlb_inst->translate_valid) c.tlb_hits++;
+        }
+        if (tlb == TLB_LOAD_PDE && tlb_state_r != TLB_LOAD_PDE) c.tlb_walks++;
+        tlb_state_r = tlb;
+
+        if (m.prefetch_fifo_inst->prefetchfifo_accept_empty) c.pf_empty++;
+
+        // avm_read/avm_write stay up until !avm_waitrequest
+        if (rd_left) {
+            if (s.avm_readdatavalid) {
+                if (rd_wait >= 0) c.rd.add(rd_wait);
+                rd_wait = -1;
+                rd_left--;
+            } else if (rd_wait >= 0)
+                rd_wait++;
+        } else if (s.avm_read) {
+            if (rd_wait < 0) rd_wait = 0;
+            if (!s.avm_waitrequest) rd_left = s.avm_burstcount ? s.avm_burstcount : 1;
+            rd_wait++;
+        }
+        if (s.avm_write) {
+            if (wr_wait < 0) wr_wait = 0;
+            if (!s.avm_waitrequest) {
+                c.wr.add(wr_wait);
+                wr_wait = -1;
+            } else
+                wr_wait++;
+        }
+    }
+
+    // Full report, at exit or on request from the guest
+    void report(FILE *f) const {
+        fprintf(f, "Perf: %llu cycles\n", (unsigned long long)c.cycles);
+        fprintf(f, "  L1 icache:     %llu requests, %llu misses (%.2f%% hit), %llu line fills\n",
+                (unsigned long long)c.ic_requests, (unsigned long long)c.ic_misses,
+                pct(c.ic_requests - c.ic_misses, c.ic_requests), (unsigned long long)c.ic_fills);
+        fprintf(f, "  TLB:           %llu lookups, %llu hits (%.2f%%), %llu walks\n",
+                (unsigned long long)c.tlb_lookups, (unsigned long long)c.tlb_hits, pct(c.tlb_hits, c.tlb_lookups),
+                (unsigned long long)c.tlb_walks);
+        fprintf(f, "  prefetch FIFO: empty %.2f%% of cycles\n", pct(c.pf_empty, c.cycles));
+        histogram(f, "memory reads:", c.rd);
+        histogram(f, "memory writes:", c.wr);
+    }
+
+    // One line of what changed since the last call, for EV_VSYNC
+    void frame_line(FILE *f, long long time) {
+        const Counts &l = last;
+        uint64_t ic_req = c.ic_requests - l.ic_requests, ic_miss = c.ic_misses - l.ic_misses;
+        uint64_t rd_n = c.rd.n - l.rd.n, wr_n = c.wr.n - l.wr.n;
+        fprintf(f, "%8lld: PERF: cycles=%llu ic-hit=%.1f%% tlb-hit=%.1f%% walks=%llu pf-empty=%.1f%% "
+                "rd=%llu/%.1f wr=%llu/%.1f\n",
+                time, (unsigned long long)(c.cycles - l.cycles), pct(ic_req - ic_miss, ic_req),
+                pct(c.tlb_hits - l.tlb_hits, c.tlb_lookups - l.tlb_lookups),
+                (unsigned long long)(c.tlb_walks - l.tlb_walks), pct(c.pf_empty - l.pf_empty, c.cycles - l.cycles),
+                (unsigned long long)rd_n, rd_n ? (double)(c.rd.sum - l.rd.sum) / rd_n : 0,
+                (unsigned long long)wr_n, wr_n ? (double)(c.wr.sum - l.wr.sum) / wr_n : 0);
+        last = c;
+    }
+
+private:
+    // l1_icache.v and tlb.v state encodings
+    static const uint8_t IC_IDLE = 1, IC_READONE = 3, IC_FILLCACHE = 4;
+    static const uint8_t TLB_CODE_CHECK = 1, TLB_LOAD_PDE = 2, TLB_CHECK_CHECK = 9, TLB_WRITE_CHECK = 10,
+                         TLB_READ_CHECK = 14;
+
+    static double pct(uint64_t a, uint64_t b) { return b ? 100.0 * a / b : 0; }
+
+    static void histogram(FILE *f, const char *name, const Histogram &h) {
+        fprintf(f, "  %-15s%llu, latency mean %.1f, p50 <=%llu, p99 <=%llu, max %llu cycles\n", name,
+                (unsigned long long)h.n, h.mean(), (unsigned long long)h.quantile(0.5),
+                (unsigned long long)h.quantile(0.99), (unsigned long long)h.max);
+        if (!h.n) return;
+        fprintf(f, "   ");
+        for (int b = 0; b < Histogram::BUCKETS; b++) {
+            if (!h.bucket[b]) continue;
+            if (b == 0) fprintf(f, " [0]");
+            else if (b == 1) fprintf(f, " [1]");
+            else if (b == Histogram::BUCKETS - 1) fprintf(f, " [%llu-]", 1ull << (b - 1));
+            else fprintf(f, " [%llu-%llu]", 1ull << (b - 1), (1ull << b) - 1);
+            fprintf(f, " %llu", (unsigned long long)h.bucket[b]);
+        }
+        fprintf(f, "\n");
+    }
+
+    Counts c, last;
+    uint8_t ic_state_r = 0, tlb_state_r = 0;
+    bool ic_filled = false;
+    int rd_left = 0;
+    int64_t rd_wait, wr_wait;           // cycles since the request, -1: none
+};
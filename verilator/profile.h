@@ -0,0 +1,95 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Sampling profiler for --profile. The caller samples the linear code address
+// (cs*16 + eip, the same address --symbols files use) every N cycles. Samples
+// go into a flat histogram, and only at exit are they resolved to the
+// enclosing symbol, i.e. the last symbol at or below the address.
+class Profiler {
+public:
+    void sample(uint32_t addr) {
+        if (addr < FLAT_SIZE) flat[addr]++;
+        else high[addr]++;
+        total++;
+    }
+
+    uint64_t samples() const { return total; }
+
+    // Top-N symbols by samples
+    void report(FILE *f, const std::map<uint32_t, std::string> &symbols, int top_n) const {
+        std::vector<std::pair<uint64_t, std::string>> rows;
+        for (auto &[name, n] : by_symbol(symbols)) rows.push_back({n, name});
+        std::sort(rows.begin(), rows.end(), [](auto &a, auto &b) { return a.first > b.first; });
+        fprintf(f, "Profile: %llu samples, %zu symbols\n", (unsigned long long)total, rows.size());
+        fprintf(f, "%10s %7s %7s  %s\n", "samples", "%", "cum%", "symbol");
+        uint64_t cum = 0;
+        for (int i = 0; i < (int)rows.size() && i < top_n; i++) {
+            cum += rows[i].first;
+            fprintf(f, "%10llu %6.2f%% %6.2f%%  %s\n", (unsigned long long)rows[i].first,
+                    100.0 * rows[i].first / total, 100.0 * cum / total, rows[i].second.c_str());
+        }
+    }
+
+    // Folded stacks ("region;symbol count" lines) for flamegraph.pl / speedscope
+    bool write_folded(const char *fname, const std::map<uint32_t, std::string> &symbols) const {
+        FILE *f = fopen(fname, "w");
+        if (!f) {
+            printf("Cannot open %s for writing\n", fname);
+            return false;
+        }
+        for (auto &[name, n] : by_symbol(symbols, true))
+            fprintf(f, "%s %llu\n", name.c_str(), (unsigned long long)n);
+        fclose(f);
+        return true;
+    }
+
+private:
+    static const uint32_t FLAT_SIZE = 0x110000;     // real mode reach, 1MB + HMA
+
+    // Memory region of a linear address, root frame of the folded stacks
+    static const char *region(uint32_t addr) {
+        if (addr < 0xA0000) return "ram";
+        if (addr >= 0xC0000 && addr < 0xC8000) return "vga_bios";
+        if (addr >= 0xF0000 && addr < 0x100000) return "bios";
+        if (addr < 0x100000) return "upper";
+        return "extended";
+    }
+
+    std::map<std::string, uint64_t> by_symbol(const std::map<uint32_t, std::string> &symbols, bool folded = false) const {
+        // sorted range table: symbol i covers [start[i], start[i+1])
+        std::vector<uint32_t> start;
+        std::vector<const std::string *> name;
+        for (auto &[addr, sym] : symbols) {
+            start.push_back(addr);
+            name.push_back(&sym);
+        }
+        std::map<std::string, uint64_t> out;
+        auto add = [&](uint32_t addr, uint64_t n) {
+            auto it = std::upper_bound(start.begin(), start.end(), addr);
+            char buf[16];
+            std::string sym;
+            uint32_t sym_start = it == start.begin() ? 0 : *(it - 1);
+            if (it == start.begin() || region(sym_start) != region(addr) || addr - sym_start >= 0x10000) {
+                // no symbol for this code, bucket by 4KB page
+                snprintf(buf, sizeof(buf), "%05x", addr & ~0xfffu);
+                sym = buf;
+            } else
+                sym = *name[it - start.begin() - 1];
+            out[folded ? std::string(region(addr)) + ";" + sym : sym] += n;
+        };
+        for (uint32_t a = 0; a < FLAT_SIZE; a++)
+            if (flat[a]) add(a, flat[a]);
+        for (auto &[a, n] : high) add(a, n);
+        return out;
+    }
+
+    std::vector<uint32_t> flat = std::vector<uint32_t>(FLAT_SIZE);
+    std::unordered_map<uint32_t, uint64_t> high;
+    uint64_t total = 0;
+};
@@ -0,0 +1,95 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+// Snapshot history for --rewind. Snapshots are the write_state() stream, and
+// only the newest is kept in full. Each older one is a reverse delta, the 4KB
+// pages where it differs from the next newer snapshot. SDRAM and disk pages
+// the guest did not touch in an interval cost nothing, which keeps dozens of
+// snapshots of a ~40MB state affordable. Getting snapshot i applies the deltas
+// from the newest back to i. Dropping the oldest is free.
+//
+// The stream must keep its layout from snapshot to snapshot for the deltas to
+// stay small, see write_state().
+class Rewind {
+public:
+    static const size_t PAGE = 4096;
+
+    explicit Rewind(size_t depth = 64) : depth(depth) {}
+
+    void set_depth(size_t d) { depth = std::max<size_t>(d, 1); }
+
+    void add(uint64_t time, const uint8_t *data, size_t len) {
+        if (!snaps.empty()) {
+            // reverse delta of the current newest, against the new one
+            Snap &prev = snaps.back();
+            for (size_t off = 0; off < full.size(); off += PAGE) {
+                size_t n = std::min(PAGE, full.size() - off);
+                if (off + n > len || memcmp(&full[off], data + off, n) != 0) {
+                    prev.pages.push_back(off / PAGE);
+                    prev.data.insert(prev.data.end(), full.begin() + off, full.begin() + off + n);
+                }
+            }
+            delta_bytes += prev.data.size();
+        }
+        full.assign(data, data + len);
+        snaps.push_back({time, len, {}, {}});
+        while (snaps.size() > depth) {
+            delta_bytes -= snaps.front().data.size();
+            snaps.pop_front();
+        }
+    }
+
+    size_t size() const { return snaps.size(); }
+    bool empty() const { return snaps.empty(); }
+    uint64_t time(size_t i) const { return snaps[i].time; }
+    size_t bytes() const { return full.size() + delta_bytes; }
+
+    // newest snapshot at or before t, -1 if none
+    int find(uint64_t t) const {
+        for (int i = (int)snaps.size() - 1; i >= 0; i--)
+            if (snaps[i].time <= t) return i;
+        return -1;
+    }
+
+    void get(size_t i, std::vector<uint8_t> &out) const {
+        out = full;
+        for (size_t j = snaps.size() - 1; j-- > i;) {
+            const Snap &s = snaps[j];
+            out.resize(s.len);
+            for (size_t k = 0; k < s.pages.size(); k++) {
+                size_t off = (size_t)s.pages[k] * PAGE;
+                memcpy(&out[off], &s.data[k * PAGE], std::min(PAGE, s.len - off));
+            }
+        }
+    }
+
+    // History after snapshot i is gone once the simulation diverges from it
+    void truncate(size_t i) {
+        if (i + 1 >= snaps.size()) return;
+        get(i, full);
+        while (snaps.size() > i + 1) {
+            delta_bytes -= snaps.back().data.size();
+            snaps.pop_back();
+        }
+        delta_bytes -= snaps.back().data.size();
+        snaps.back().pages.clear();
+        snaps.back().data.clear();
+    }
+
+private:
+    struct Snap {
+        uint64_t time;
+        size_t len;
+        std::vector<uint32_t> pages;    // changed pages, ascending
+        std::vector<uint8_t> data;      // PAGE bytes each, the last page may be short
+    };
+
+    size_t depth;
+    std::deque<Snap> snaps;
+    std::vector<uint8_t> full;          // the newest snapshot
+    size_t delta_bytes = 0;
+};
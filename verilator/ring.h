@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// Fixed-size single-producer single-consumer queue. push() and pop() never
+// block and never allocate, so the simulation thread can hand data to or take
+// data from a helper thread without ever waiting on it. N must be a power of 2.
+template <class T, size_t N>
+class SpscRing {
+    static_assert((N & (N - 1)) == 0, "SpscRing size must be a power of 2");
+public:
+    // producer side, false if full
+    bool push(const T &v) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == N) return false;
+        buf[h & (N - 1)] = v;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, false if empty
+    bool pop(T &v) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t) return false;
+        v = buf[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+
+private:
+    T buf[N];
+    alignas(64) std::atomic<size_t> head{0};    // next slot to write
+    alignas(64) std::atomic<size_t> tail{0};    // next slot to read
+};
+
+// Fixed-size FIFO for use on one thread, O(1) push and pop. N must be a power of 2.
+template <class T, size_t N>
+class Fifo {
+    static_assert((N & (N - 1)) == 0, "Fifo size must be a power of 2");
+public:
+    bool push(const T &v) {
+        if (head - tail == N) return false;
+        buf[head++ & (N - 1)] = v;
+        return true;
+    }
+    const T &front() const { return buf[tail & (N - 1)]; }
+    void pop() { tail++; }
+    size_t size() const { return head - tail; }
+    bool empty() const { return head == tail; }
+    void clear() { head = tail = 0; }
+    const T &operator[](size_t i) const { return buf[(tail + i) & (N - 1)]; }   // i-th oldest
+
+private:
+    T buf[N];
+    size_t head = 0, tail = 0;
+};
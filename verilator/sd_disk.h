@@ -0,0 +1,149 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// SD card contents behind the sd_read()/sd_write() DPI calls of
+// driver_sd_sim.v. The image is mapped MAP_PRIVATE, so only the sectors the guest
+// touches are paged in, clean pages are shared through the page cache with other
+// machines using the same file, and writes stay private until persisted. The
+// image size is only limited by the SD sector number (8GB).
+//
+// Two flags per 512-byte sector:
+// - dirty: written since the last persist, see persist_disk()
+// - written: differs from the file as opened, saved in snapshots. The first
+//   write keeps the original sector, so a restore can undo later writes.
+class SdDisk {
+public:
+    SdDisk() = default;
+    SdDisk(const SdDisk &) = delete;
+    SdDisk &operator=(const SdDisk &) = delete;
+    ~SdDisk() { close(); }
+
+    bool open(const std::string &fname) {
+        close();
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd < 0) {
+            perror(fname.c_str());
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            perror(fname.c_str());
+            ::close(fd);
+            return false;
+        }
+        n = st.st_size;
+        if (n) {
+            void *p = mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+            if (p == MAP_FAILED) {
+                perror(fname.c_str());
+                ::close(fd);
+                n = 0;
+                return false;
+            }
+            base = (uint8_t *)p;
+        }
+        ::close(fd);
+        size_t sectors = (n + 511) / 512;
+        dirty.assign(sectors, 0);
+        written.assign(sectors, 0);
+        return true;
+    }
+
+    void close() {
+        if (base) munmap(base, n);
+        base = nullptr;
+        n = 0;
+        dirty.clear();
+        written.clear();
+        original.clear();
+    }
+
+    uint64_t size() const { return n; }
+
+    // dword at a byte address, 0 past the end like an empty SD buffer
+    uint32_t read32(uint64_t addr) const {
+        uint32_t v = 0;
+        if (addr + 4 <= n) memcpy(&v, base + addr, 4);
+        return v;
+    }
+
+    void write32(uint64_t addr, uint32_t v) {
+        if (addr + 4 > n) return;
+        touch(addr >> 9);
+        memcpy(base + addr, &v, 4);
+    }
+
+    void read(uint64_t addr, void *buf, size_t len) const {
+        size_t k = addr < n ? std::min<uint64_t>(len, n - addr) : 0;
+        memcpy(buf, base + addr, k);
+        memset((uint8_t *)buf + k, 0, len - k);
+    }
+
+    // A whole sector, e.g. from an overlay. Not dirty, the overlay already has it.
+    void load_sector(uint32_t sector, const uint8_t *data) {
+        if ((uint64_t)sector * 512 + 512 > n) return;
+        touch(sector);
+        dirty[sector] = 0;
+        memcpy(base + (uint64_t)sector * 512, data, 512);
+    }
+
+    // A sector never crosses a page, so all 512 bytes are mapped even for a
+    // partial last sector
+    const uint8_t *sector(uint32_t s) const { return base + (uint64_t)s * 512; }
+    size_t sectors() const { return dirty.size(); }
+
+    std::vector<uint8_t> dirty;         // 1 byte per sector, 1: written since last persist
+
+    // transfers started by driver_sd, see Simulator::disk_command()
+    uint64_t commands = 0, sectors_read = 0, sectors_written = 0;
+
+    // Sectors that differ from the file as opened, for snapshots
+    std::vector<uint32_t> written_sectors() const {
+        std::vector<uint32_t> v;
+        for (auto &o : original) v.push_back(o.first);
+        std::sort(v.begin(), v.end());
+        return v;
+    }
+
+    // Back to the file contents plus these sectors, as saved by written_sectors()
+    void restore(const std::vector<uint32_t> &sectors, const uint8_t *data) {
+        for (auto &o : original) {
+            memcpy(base + (uint64_t)o.first * 512, o.second.data(), bytes(o.first));
+            written[o.first] = 0;
+        }
+        original.clear();
+        for (size_t i = 0; i < sectors.size(); i++)
+            if (sectors[i] < dirty.size()) {
+                touch(sectors[i]);
+                memcpy(base + (uint64_t)sectors[i] * 512, data + i * 512, bytes(sectors[i]));
+            }
+    }
+
+private:
+    void touch(uint64_t s) {
+        dirty[s] = 1;
+        if (!written[s]) {
+            written[s] = 1;
+            memcpy(original[s].data(), base + s * 512, bytes(s));
+        }
+    }
+
+    // the last sector can be partial
+    size_t bytes(uint64_t s) const { return std::min<uint64_t>(512, n - s * 512); }
+
+    uint8_t *base = nullptr;
+    uint64_t n = 0;
+    std::vector<uint8_t> written;
+    std::unordered_map<uint32_t, std::array<uint8_t, 512>> original;
+};
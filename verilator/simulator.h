@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <svdpi.h>
+#include "verilated.h"
+#include "Vsystem.h"
+#include "Vsystem_ao486.h"
+#include "Vsystem_system.h"
+#include "Vsystem_pipeline.h"
+#include "Vsystem_exception.h"
+#include "guest_mem.h"
+#include "ring.h"
+#include "vga_timing.h"
+#include "sd_disk.h"
+
+// One simulated machine: its own VerilatedContext, model, clocks and disk
+// bookkeeping, so several can run in one process, each on its own thread.
+// main.cpp drives one of these interactively. run() is the bare headless loop
+// for --jobs, which only records what a test needs to check: POST codes,
+// BIOS debug port output, INT 10h teletype output and CPU shutdown.
+class Simulator {
+public:
+    explicit Simulator(const std::string &name = "TOP")
+        : ctx(new VerilatedContext), model(new Vsystem(ctx.get(), name.c_str())) {
+        model->clock_rate = 25000000;           // for time keeping of timer, RTC and floppy
+        model->clock_rate_vga = 50000000;       // >= max VGA pixel clock (28.3Mhz)
+        mem.attach(&model->system->sdram__DOT__mem[0], sizeof(model->system->sdram__DOT__mem));
+        // DPI calls from driver_sd find their machine through the scope
+        Verilated::threadContextp(ctx.get());
+        svScope sd = svGetScopeFromName((name + ".system.driver_sd").c_str());
+        if (sd) svPutUserData(sd, &scope_key, this);
+    }
+    Simulator(const Simulator &) = delete;
+    Simulator &operator=(const Simulator &) = delete;
+
+    ~Simulator() {
+        model->final();
+        scope_last = nullptr;           // the scope may be reused by the next model on this thread
+    }
+
+    Vsystem &top() { return *model; }
+
+    // Machine of the driver_sd instance making a DPI call. The lookup is cached
+    // per thread, as a machine only runs on one thread.
+    static Simulator *from_scope() {
+        svScope s = svGetScope();
+        if (s != scope_last) {
+            scope_last = s;
+            scope_sim = (Simulator *)svGetUserData(s, &scope_key);
+        }
+        return scope_sim;
+    }
+
+    // Half a clk_vga period. clk_vga is 50Mhz, clk_sys 25Mhz, so clk_sys
+    // toggles on every other call and a clk_sys cycle is 4 steps. With the VGA
+    // clock gated every call is half a clk_sys period, worth 2 steps of time,
+    // and the retrace status comes from VgaTiming instead.
+    void clock() {
+        posedge = false;
+        if (vga_gated) {
+            model->clk_sys = !model->clk_sys;
+            posedge = model->clk_sys;
+            model->clk_audio = model->clk_sys;
+            time += 2;
+            vsync_start = posedge && vga_timing.tick(*model->system->vga);
+            return;
+        }
+        model->clk_vga = !model->clk_vga;
+        if (model->clk_vga) {
+            model->clk_sys = !model->clk_sys;
+            posedge = model->clk_sys;
+            model->clk_audio = model->clk_sys;  // should be 24.576Mhz, 25Mhz is close enough
+        }
+        time++;
+    }
+
+    void step() {
+        clock();
+        model->eval();
+    }
+
+    // steps per clk_sys cycle
+    int cycle_steps() const { return vga_gated ? 2 : 4; }
+    // time per clk_sys cycle, gated or not
+    static const uint64_t CYCLE_TIME = 4;
+
+    void full_step() {
+        for (int i = cycle_steps(); i; i--) step();
+    }
+
+    void ensure_posedge() {
+        while (!posedge) step();
+    }
+
+    bool load_disk(const std::string &fname) { return disk.open(fname); }
+
+    // driver_sd starts a transfer. The data is served from the mapped image
+    // either way, the return value is only the cycles the card waits first.
+    uint32_t disk_command(bool write, uint32_t sector, uint32_t count) {
+        disk.commands++;
+        (write ? disk.sectors_written : disk.sectors_read) += count;
+        return disk_latency + disk_sector_latency * count;
+    }
+
+    // Do what the boot loader in system.sv does, without the SD transfers.
+    // boot0.rom (image offset 0) goes to 0xF0000 and boot1.rom (offset 64KB)
+    // to 0xC0000. The config sectors 192-194 hold address/data dword pairs,
+    // ending at address 0, which are written to the mgmt bus one per cycle.
+    // The loader is parked in an unused state meanwhile, then BOOT_COMPLETE
+    // releases the CPU on the next cycle. Call right after reset.
+    bool fast_boot() {
+        Vsystem_system *s = model->system;
+        std::vector<uint8_t> rom(0x18000);
+        disk.read(0, rom.data(), rom.size());
+        mem.write(0xF0000, rom.data(), 0x10000);
+        mem.write(0xC0000, rom.data() + 0x10000, 0x8000);
+
+        // the loader leaves BOOT_IDLE once reset is over and SDRAM is ready
+        for (int i = 0; s->boot_state == BOOT_IDLE; i++) {
+            if (i == 1000000) {
+                printf("Fast boot: boot loader did not start\n");
+                return false;
+            }
+            full_step();
+        }
+        s->boot_state = BOOT_PARKED;
+
+        int writes = 0;
+        for (uint32_t off = 192 * 512; off + 8 <= 195 * 512; off += 8) {
+            uint32_t addr = disk.read32(off), data = disk.read32(off + 4);
+            if (addr == 0) break;
+            s->mgmt_address = addr;
+            s->mgmt_writedata = data;
+            s->mgmt_write = 1;                  // cleared by system.sv on this posedge
+            full_step();
+            writes++;
+        }
+        s->boot_state = BOOT_COMPLETE;
+        printf("%8lld: Fast boot: BIOS and VGA BIOS preloaded, %d config writes, releasing CPU\n",
+               (long long)time, writes);
+        return true;
+    }
+
+    // Reset, open the image, release reset and optionally fast boot
+    bool boot(const std::string &fname, bool fast) {
+        ensure_posedge();
+        model->reset = 1;
+        full_step();
+        if (!load_disk(fname)) return false;
+        model->reset = 0;
+        return !fast || fast_boot();
+    }
+
+    // Headless run for --jobs until `until` or CPU shutdown
+    void run(uint64_t until) {
+        Vsystem_system *s = model->system;
+        while (time < until && !shutdown) {
+            step();
+            if (!posedge) continue;
+            bool io_write = s->cpu_io_write_do;
+            if (io_write && !io_write_r) {
+                if (s->cpu_io_write_address == 0x190) post_code = s->cpu_io_write_data & 0xff;
+                if (s->cpu_io_write_address == 0x8888) debug_out += (char)(s->cpu_io_write_data & 0xff);
+            }
+            io_write_r = io_write;
+            uint32_t eip = s->ao486->exe_eip;
+            if (eip != eip_r) {
+                eip_r = eip;
+                uint32_t eax = s->ao486->pipeline_inst->eax;
+                if (eip == 0xA58 && s->ao486->pipeline_inst->cs == 0xC000 && (eax >> 8 & 0xff) == 0xE)
+                    screen_out += (char)(eax & 0xff);       // INT 10h teletype, as print_bios_calls() taps
+            }
+            keyboard();
+            shutdown = s->ao486->exception_inst->shutdown;
+        }
+    }
+
+    uint64_t time = 0;                  // in steps, 4 per clk_sys cycle
+    bool posedge = false;               // last step was a clk_sys posedge
+    bool vga_gated = false;             // clk_vga stopped, set before the first step
+    bool vsync_start = false;           // gated: modelled retrace started on this posedge
+    VgaTiming vga_timing;
+    GuestMem mem;                       // sdram.mem
+    SdDisk disk;                        // SD card behind driver_sd
+    uint32_t disk_latency = 0;          // cycles per SD command, 0: data right away
+    uint32_t disk_sector_latency = 0;   // and per sector
+
+    // observed by run()
+    int post_code = -1;
+    std::string debug_out, screen_out;
+    bool shutdown = false;
+
+private:
+    static const int BOOT_IDLE = 0, BOOT_COMPLETE = 8, BOOT_PARKED = 15;
+
+    // Answer keyboard controller commands like main.cpp keyboard_service(), no typing
+    void keyboard() {
+        if (time - kbd_time > 100000 && !kbd.empty()) {
+            model->kbd_data = kbd.front();
+            model->kbd_data_valid = 1;
+            kbd.pop();
+            kbd_time = time;
+        } else
+            model->kbd_data_valid = 0;
+        if (model->kbd_host_data & 0x100) {
+            uint8_t cmd = model->kbd_host_data & 0xff;
+            model->kbd_host_data_clear = 1;
+            if (cmd == 0xFF) {
+                kbd.push(0xFA);
+                kbd.push(0xAA);
+            } else if (cmd >= 0xF0)
+                kbd.push(0xFA);
+            kbd_time = time;
+        } else if (model->kbd_host_data_clear)
+            model->kbd_host_data_clear = 0;
+    }
+
+    static inline char scope_key;       // svPutUserData key, only its address matters
+    static inline thread_local svScope scope_last;
+    static inline thread_local Simulator *scope_sim;
+
+    std::unique_ptr<VerilatedContext> ctx;
+    std::unique_ptr<Vsystem> model;
+    bool io_write_r = false;
+    uint32_t eip_r = 0;
+    Fifo<uint8_t, 16> kbd;
+    uint64_t kbd_time = 0;
+};
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Build 1/2/4/8-thread models and compare simulated clk_sys cycles/s on the
+# boot workload (reset, boot loader and BIOS POST, headless).
+#
+# Usage: ./thread_sweep.sh <sdcard.img> [stop_time] [thread counts...]
+set -e
+
+IMG=${1:?usage: $0 <sdcard.img> [stop_time] [threads...]}
+STOP=${2:-6000000}
+shift; [ $# -gt 0 ] && shift
+THREADS_LIST=${*:-1 2 4 8}
+
+for t in $THREADS_LIST; do
+    make -s THREADS=$t debug >/dev/null
+done
+
+printf "%-8s %14s %10s\n" threads cycles/s seconds
+for t in $THREADS_LIST; do
+    if [ "$t" = 1 ]; then dir=obj_dir; else dir=obj_dir_mt$t; fi
+    line=$(./$dir/Vsystem --headless -e $STOP "$IMG" | grep "^Simulation speed:")
+    # Simulation speed: N cycles/s (C clk_sys cycles in S.SSs, T threads)
+    speed=$(echo "$line" | awk '{print $3}')
+    secs=$(echo "$line" | sed 's/.* in \([0-9.]*\)s.*/\1/')
+    printf "%-8s %14s %10s\n" "$t" "$speed" "$secs"
+done
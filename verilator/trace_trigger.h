@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Conditions that start (--trace-on) or stop (--trace-off) FST tracing:
+//   eip=<eip>              EIP reaches a value, in any code segment
+//   eip=<cs>:<eip>         CS:EIP
+//   io=<port>[:<value>]    I/O write to a port, optionally of that byte
+//   post=<code>            POST code (port 190h)
+//   watch                  any --watch watchpoint hit
+//   frame=<n>              VSYNC number n (decimal)
+// Numbers are hex except the frame. A condition fires every time it matches
+// while tracing is in the other state, so a window can open and close
+// repeatedly.
+class TraceTriggers {
+public:
+    enum Kind { EIP, IO, WATCH, FRAME };
+    struct Cond {
+        Kind kind;
+        bool on;                        // --trace-on
+        uint32_t a = 0, b = 0;          // EIP and CS, port and value, frame
+        bool has_b = false;
+        std::string spec;
+    };
+
+    bool add(const std::string &spec, bool on) {
+        Cond c;
+        c.on = on;
+        c.spec = spec;
+        size_t eq = spec.find('=');
+        std::string key = spec.substr(0, eq), val = eq == std::string::npos ? "" : spec.substr(eq + 1);
+        size_t colon = val.find(':');
+        bool ok = !val.empty() || key == "watch";
+        if (key == "eip" || key == "io") {
+            c.kind = key == "eip" ? EIP : IO;
+            std::string first = val.substr(0, colon);
+            ok &= parse(first, 16, c.a);
+            if (colon != std::string::npos) {
+                ok &= parse(val.substr(colon + 1), 16, c.b);
+                c.has_b = true;
+                if (c.kind == EIP) std::swap(c.a, c.b);     // written CS first
+            }
+        } else if (key == "post") {
+            c.kind = IO;
+            c.a = 0x190;
+            c.has_b = true;
+            ok &= parse(val, 16, c.b);
+        } else if (key == "watch") {
+            c.kind = WATCH;
+            ok &= val.empty();
+        } else if (key == "frame") {
+            c.kind = FRAME;
+            ok &= parse(val, 10, c.a);
+        } else
+            ok = false;
+        if (!ok) {
+            printf("Bad trace condition %s, want eip=[<cs>:]<eip>, io=<port>[:<value>], post=<code>, watch or frame=<n>\n",
+                   spec.c_str());
+            return false;
+        }
+        conds.push_back(c);
+        return true;
+    }
+
+    bool uses(Kind k) const {
+        for (const Cond &c : conds)
+            if (c.kind == k) return true;
+        return false;
+    }
+
+    // First condition of this kind that matches and would change the tracing state
+    const Cond *match(Kind k, uint32_t a, uint32_t b, bool tracing) const {
+        for (const Cond &c : conds)
+            if (c.kind == k && c.on != tracing && c.a == a && (!c.has_b || c.b == b)) return &c;
+        return nullptr;
+    }
+
+    bool empty() const { return conds.empty(); }
+
+private:
+    static bool parse(const std::string &s, int base, uint32_t &v) {
+        char *end;
+        v = strtoul(s.c_str(), &end, base);
+        return !s.empty() && *end == 0;
+    }
+
+    std::vector<Cond> conds;
+};
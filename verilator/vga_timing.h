@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include "Vsystem_vga.h"
+
+// CRTC timing model for --vga-gate. With clk_vga stopped, the pixel pipeline
+// in vga.v is frozen. Only the status bits the CPU can see are kept running:
+// - vertical retrace and display enable (input status 1, port 3DA)
+// - the vertical blank start that raises IRQ2
+// They are computed here from the CRTC registers, once per clk_sys cycle, and
+// written into the vgaprep_* flops. Sync and blank follow the same per-line
+// rules as vga.v. Lines start at horizontal position 0 instead of at HSYNC,
+// which only shifts the phase.
+class VgaTiming {
+public:
+    // One clk_sys cycle, before eval(). Returns true when vertical retrace starts.
+    bool tick(Vsystem_vga &v) {
+        if (blank_rise) {
+            v.vgaprep_vert_blank_last = 1;      // one cycle of blank start for the IRQ2 edge detect
+            blank_rise = false;
+        }
+        t += pixclk;
+        bool retrace = false;
+        if (t >= line_units) {
+            t -= line_units;
+            retrace = next_line(v);
+        }
+        bool displaying = (t < hdisp_units || t >= hlast_units) && line <= vdisp;
+        v.vgaprep_not_displaying = !displaying;
+        return retrace;
+    }
+
+    // How many of the next n clk_sys cycles can pass without vertical retrace
+    // or blank starting, for --idle-skip. Those cycles still have to be run
+    // through tick(), which is cheap next to eval().
+    uint64_t quiet_cycles(const Vsystem_vga &v, uint64_t n) const {
+        if (blank_rise || !line_units) return 0;
+        uint32_t pc = pixclk, next_pc;
+        uint64_t lu = line_units, next_lu, tt = t, done = 0;
+        line_clocks(v, next_pc, next_lu);       // registers do not change meanwhile
+        uint32_t l = line;
+        bool vs = v.vgaprep_vert_sync, vb = v.vgaprep_vert_blank;
+        for (;;) {
+            uint64_t left = (lu - tt + pc - 1) / pc;    // ticks to the next line, including that one
+            if (n - done < left) return n;
+            l = l + 1 >= v.crtc_vertical_total + 2u ? 0 : l + 1;
+            bool nvs, nvb;
+            sync_blank(v, l, vs, vb, nvs, nvb);
+            if (nvs && !vs || nvb && !vb) return done + left - 1;
+            done += left;
+            tt += left * pc - lu;
+            pc = next_pc;
+            lu = next_lu;
+            if (tt >= lu) tt = 0;
+            vs = nvs;
+            vb = nvb;
+        }
+    }
+
+private:
+    static const uint64_t SYS_HZ = 25000000;        // clk_sys, Vsystem::clock_rate
+
+    bool next_line(Vsystem_vga &v) {
+        // pick up register changes at line boundaries
+        line_clocks(v, pixclk, line_units);
+        uint64_t char_units = (v.seq_8dot_char ? 8 : 9) * (v.seq_dotclock_divided ? 2 : 1) * SYS_HZ;
+        hdisp_units = v.crtc_horizontal_display_size * char_units;
+        hlast_units = (v.crtc_horizontal_total + 4) * char_units;
+        vdisp = v.crtc_vertical_display_size;
+        if (t >= line_units) t = 0;
+
+        line = line + 1 >= v.crtc_vertical_total + 2u ? 0 : line + 1;     // VGA_V_TOTAL_EXTRA
+        bool vs, vb;
+        sync_blank(v, line, v.vgaprep_vert_sync, v.vgaprep_vert_blank, vs, vb);
+
+        bool retrace = vs && !v.vgaprep_vert_sync;
+        blank_rise = vb && !v.vgaprep_vert_blank;
+        v.vgaprep_vert_blank_last = blank_rise ? 0 : vb;
+        v.vgaprep_vert_sync = vs;
+        v.vgaprep_vert_blank = vb;
+        return retrace;
+    }
+
+    static void line_clocks(const Vsystem_vga &v, uint32_t &pixclk, uint64_t &line_units) {
+        static const uint32_t clocks[4] = {25175000, 28322000, 32514000, 35900000};
+        unsigned sel = v.general_clock_select | (v.crtc_reg34 >> 1 & 1) << 2 | (v.crtc_reg31 >> 6 & 1) << 3;
+        pixclk = clocks[sel < 3 ? sel : 3];
+        uint64_t char_units = (v.seq_8dot_char ? 8 : 9) * (v.seq_dotclock_divided ? 2 : 1) * SYS_HZ;
+        line_units = (v.crtc_horizontal_total + 5) * char_units;        // VGA_H_TOTAL_EXTRA
+    }
+
+    // vertical sync and blank at the start of line l, from their values before
+    static void sync_blank(const Vsystem_vga &v, uint32_t l, bool vs0, bool vb0, bool &vs, bool &vb) {
+        vs = vs0;
+        vb = vb0;
+        if (l == v.crtc_vertical_retrace_start) vs = 1;
+        else if ((l & 15) == v.crtc_vertical_retrace_end && vs) vs = 0;
+        else if ((l & 255) == v.crtc_vertical_blanking_end && vs) vs = 0;
+        if (l == v.crtc_vertical_blanking_start) vb = 1;
+        else if ((l & 255) == v.crtc_vertical_blanking_end && vb) vb = 0;
+    }
+
+    // t is the position in the line in pixel clocks times SYS_HZ, so one
+    // clk_sys cycle adds pixclk
+    uint64_t t = 0, line_units = 0, hdisp_units = 0, hlast_units = 0;
+    uint32_t pixclk = 25175000;
+    uint32_t line = 0, vdisp = 0;
+    bool blank_rise = false;
+};
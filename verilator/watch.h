@@ -0,0 +1,118 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "guest_mem.h"
+
+// Memory watchpoints for --watch and --mem. Watched ranges mark their 4KB
+// pages in one bitmap for reads and one for writes, covering the 32MB of
+// sdram.mem. An access to an unmarked page costs one bit test. Only accesses to
+// a marked page compare against the ranges.
+//
+// Spec: <start>[-<end>|+<len>][,r|w|rw][,be=<mask>][,trace|,snap]
+//   0xb8000+4000,w      writes to the text mode screen
+//   0x400-0x4ff,rw      BIOS data area, reads and writes
+//   0x46c,w,be=1,snap   low byte of the timer tick, snapshot on the first hit
+// Addresses are physical (the Avalon bus after paging), <end> is inclusive,
+// the default is writes only.
+// be=<mask> only matches accesses that use one of those byte lanes. trace
+// starts tracing and snap saves a state file on the first hit.
+class Watchpoints {
+public:
+    enum { READ = 1, WRITE = 2 };
+    enum Action { LOG, TRACE, SNAPSHOT };
+    struct Watch {
+        uint32_t lo, hi;                    // inclusive byte range
+        uint8_t mode, lanes;
+        Action action;
+        uint64_t hits = 0;
+        uint32_t addr = 0;                  // start as the caller knows it, e.g. GDB's linear address
+    };
+
+    bool parse(const std::string &spec) {
+        Watch w = {0, 0, WRITE, 0xf, LOG};
+        size_t comma = spec.find(',');
+        if (!parse_range(spec.substr(0, comma), w.lo, w.hi)) return bad(spec);
+        while (comma != std::string::npos) {
+            size_t next = spec.find(',', comma + 1);
+            std::string opt = spec.substr(comma + 1, next == std::string::npos ? std::string::npos : next - comma - 1);
+            comma = next;
+            if (opt == "r") w.mode = READ;
+            else if (opt == "w") w.mode = WRITE;
+            else if (opt == "rw") w.mode = READ | WRITE;
+            else if (opt == "trace") w.action = TRACE;
+            else if (opt == "snap") w.action = SNAPSHOT;
+            else if (opt.compare(0, 3, "be=") == 0) w.lanes = strtoul(opt.c_str() + 3, nullptr, 0) & 0xf;
+            else return bad(spec);
+        }
+        return add(w);
+    }
+
+    bool add(const Watch &w) {
+        if (w.hi >= MEM_SIZE) {
+            printf("Watchpoint %08x-%08x is outside the %dMB of memory\n", w.lo, w.hi, MEM_SIZE >> 20);
+            return false;
+        }
+        for (uint32_t p = w.lo >> PAGE_SHIFT; p <= w.hi >> PAGE_SHIFT; p++) {
+            if (w.mode & READ) pages[0][p >> 6] |= 1ull << (p & 63);
+            if (w.mode & WRITE) pages[1][p >> 6] |= 1ull << (p & 63);
+        }
+        watches.push_back(w);
+        return true;
+    }
+
+    bool remove(uint32_t lo, uint32_t hi, uint8_t mode) {
+        for (size_t i = 0; i < watches.size(); i++)
+            if (watches[i].lo == lo && watches[i].hi == hi && watches[i].mode == mode) {
+                watches.erase(watches.begin() + i);
+                // rebuild the page bits, other ranges may share the pages
+                for (auto &b : pages) std::fill(b.begin(), b.end(), 0);
+                std::vector<Watch> keep;
+                keep.swap(watches);
+                for (const Watch &w : keep) add(w);
+                return true;
+            }
+        return false;
+    }
+
+    bool empty() const { return watches.empty(); }
+
+    // An access to dword address `dword` with byte enables `be`. Returns the
+    // first matching watchpoint, nullptr if none.
+    Watch *check(uint32_t dword, uint8_t be, int mode) {
+        uint32_t addr = dword << 2;
+        if (addr >= MEM_SIZE) return nullptr;
+        uint32_t p = addr >> PAGE_SHIFT;
+        if (!(pages[mode == WRITE][p >> 6] >> (p & 63) & 1)) return nullptr;
+        // first and last byte actually accessed
+        if (!(be & 0xf)) return nullptr;
+        uint32_t first = addr + __builtin_ctz(be), last = addr + 31 - __builtin_clz(be & 0xf);
+        for (Watch &w : watches)
+            if ((w.mode & mode) && (w.lanes & be) && first <= w.hi && last >= w.lo) {
+                w.hits++;
+                return &w;
+            }
+        return nullptr;
+    }
+
+    void report() const {
+        for (const Watch &w : watches)
+            printf("Watchpoint %08x-%08x: %llu hits\n", w.lo, w.hi, (unsigned long long)w.hits);
+    }
+
+private:
+    static const uint32_t MEM_SIZE = 32 << 20;      // sdram.mem
+    static const int PAGE_SHIFT = 12;
+    static const uint32_t PAGES = MEM_SIZE >> PAGE_SHIFT;
+
+    bool bad(const std::string &spec) {
+        printf("Bad watchpoint: %s\n", spec.c_str());
+        return false;
+    }
+
+    std::vector<uint64_t> pages[2] = {std::vector<uint64_t>(PAGES / 64), std::vector<uint64_t>(PAGES / 64)};   // read, write
+    std::vector<Watch> watches;
+};
@@ -1,16 +1,33 @@
 #pragma once
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+// 16-bit stereo WAV file. Samples are collected into blocks on the caller's
+// thread and written out by a background thread, so writeSample() is only a
+// store into memory and the simulation never waits on the disk.
 class WAVWriter {
 private:
+    static const size_t BLOCK_FRAMES = 8192;
+
     FILE* file;
     uint32_t data_size;
     uint32_t sample_rate;
     uint16_t channels;
     uint16_t bits_per_sample;
 
+    std::vector<int16_t> block;             // being filled by writeSample()
+    std::deque<std::vector<int16_t>> full;  // waiting for the writer thread
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool closing = false;
+    std::thread writer;
+
     struct WAVHeader {
         // RIFF chunk
         char riff_id[4];        // "RIFF"
@@ -44,10 +61,21 @@ public:
         
         // Write placeholder header (will be updated in destructor)
         writeHeader();
+        block.reserve(BLOCK_FRAMES * 2);
+        writer = std::thread([this] { writeBlocks(); });
     }
     
     ~WAVWriter() {
         if (file) {
+            // flush the last partial block and let the writer drain the queue
+            if (!block.empty()) queueBlock();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closing = true;
+            }
+            cv.notify_one();
+            writer.join();
+
             // Update header with final data size
             fseek(file, 0, SEEK_SET);
             writeHeader();
@@ -61,13 +89,39 @@ public:
     void writeSample(int16_t left, int16_t right) {
         if (!file) return;
         
-        // Write stereo sample (little-endian)
-        fwrite(&left, sizeof(int16_t), 1, file);
-        fwrite(&right, sizeof(int16_t), 1, file);
+        block.push_back(left);
+        block.push_back(right);
         data_size += 4;  // 2 channels * 2 bytes per sample
+        if (block.size() >= BLOCK_FRAMES * 2) queueBlock();
     }
     
 private:
+    void queueBlock() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            full.push_back(std::move(block));
+        }
+        cv.notify_one();
+        block = std::vector<int16_t>();
+        block.reserve(BLOCK_FRAMES * 2);
+    }
+
+    // Writer thread: samples are little-endian, as on the host
+    void writeBlocks() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            cv.wait(lock, [this] { return closing || !full.empty(); });
+            while (!full.empty()) {
+                std::vector<int16_t> b = std::move(full.front());
+                full.pop_front();
+                lock.unlock();
+                fwrite(b.data(), sizeof(int16_t), b.size(), file);
+                lock.lock();
+            }
+            if (closing) return;
+        }
+    }
+
     void writeHeader() {
         if (!file) return;
         